@@ -0,0 +1,415 @@
+#include "json.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#if __has_include(<sys/socket.h>)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+using namespace Json;
+
+template <typename F>
+static void BENCH(const char *name, size_t bytes, int iterations, F f)
+{
+    f();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (bytes)
+        printf("%-32s %10.3f ms %10.2f MB/s\n", name, elapsed.count() * 1000 / iterations,
+               bytes * iterations / elapsed.count() / 1e6);
+    else
+        printf("%-32s %10.3f ms\n", name, elapsed.count() * 1000 / iterations);
+}
+
+static std::u8string make_records(size_t count)
+{
+    std::u8string json = u8"[";
+    for (size_t i = 0; i < count; i++)
+    {
+        std::string id = std::to_string(i + 1);
+        if (i)
+            json += u8",";
+        json += u8"{\"Id\":" + std::u8string(id.begin(), id.end()) +
+                u8",\"Name\":\"Record\",\"Active\":true,\"Tags\":[\"a\",\"b\"],\"Score\":1.5}";
+    }
+    json += u8"]";
+    return json;
+}
+
+static void bench_schema()
+{
+    JsonValue schema_json, v;
+    JsonSchema schema;
+    json_parse(schema_json,
+        u8"{\"type\": \"array\", \"items\": {\"type\": \"object\", \"required\": [\"Id\", \"Name\"],"
+        u8" \"properties\": {\"Id\": {\"type\": \"integer\", \"minimum\": 1},"
+        u8" \"Name\": {\"type\": \"string\", \"maxLength\": 16},"
+        u8" \"Tags\": {\"type\": \"array\", \"items\": {\"enum\": [\"a\", \"b\"]}}}}}");
+    json_compile_schema(schema, schema_json);
+    JsonParseOptions options;
+    options.schema = &schema;
+
+    std::u8string json = make_records(10000);
+    //Rejected at the first record
+    std::u8string invalid = json;
+    invalid.replace(invalid.find(u8"\"Id\":1,"), 7, u8"\"Id\":0,");
+
+    BENCH("parse", json.size(), 20, [&] { json_parse(v, json); });
+    BENCH("parse + json_validate", json.size(), 20, [&] { json_parse(v, json); json_validate(schema, v); });
+    BENCH("parse with schema (accept)", json.size(), 20, [&] { json_parse(v, json, options); });
+    BENCH("parse with schema (reject)", invalid.size(), 20, [&] { json_parse(v, invalid, options); });
+}
+
+static void bench_events()
+{
+    std::u8string json = make_records(10000);
+    JsonValue v;
+    BENCH("json_parse", json.size(), 20, [&] { json_parse(v, json); });
+    BENCH("json_events", json.size(), 20, [&] {
+        for (auto &e : json_events(json))
+            (void)e;
+    });
+    BENCH("json_events + builder, 4KB chunks", json.size(), 20, [&] {
+        JsonInput in;
+        JsonValueBuilder builder(v);
+        size_t offset = 0;
+        for (auto &e : json_events(in))
+        {
+            if (e.type != JSON_EVENT_NEED_MORE)
+                builder.add(e);
+            else if (offset == json.size())
+                in.close();
+            else
+            {
+                in.feed(std::u8string_view(json).substr(offset, 4096));
+                offset += in.json.size();
+            }
+        }
+    });
+}
+
+// Source that completes every read at once, to measure the coroutine overhead
+struct MemorySource
+{
+    std::u8string_view json;
+    struct Read
+    {
+        MemorySource &source;
+        char8_t *buffer;
+        size_t size;
+        bool await_ready() { return true; }
+        void await_suspend(std::coroutine_handle<>) {}
+        size_t await_resume()
+        {
+            size_t n = std::min(size, source.json.size());
+            std::copy_n(source.json.begin(), n, buffer);
+            source.json.remove_prefix(n);
+            return n;
+        }
+    };
+    Read read(char8_t *buffer, size_t size) { return Read{*this, buffer, size}; }
+};
+
+#if __has_include(<sys/socket.h>)
+// Non-blocking socket read, suspends until the writer loop resumes it
+struct SocketSource
+{
+    int fd;
+    std::coroutine_handle<> waiting;
+
+    struct Read
+    {
+        SocketSource &source;
+        char8_t *buffer;
+        size_t size;
+        ssize_t result = -1;
+        bool await_ready() { return (result = ::read(source.fd, buffer, size)) >= 0; }
+        void await_suspend(std::coroutine_handle<> h) { source.waiting = h; }
+        size_t await_resume()
+        {
+            if (result < 0)
+                result = ::read(source.fd, buffer, size);
+            return result > 0 ? result : 0;
+        }
+    };
+    Read read(char8_t *buffer, size_t size) { return Read{*this, buffer, size}; }
+};
+#endif
+
+static void bench_async()
+{
+    std::u8string json = make_records(10000);
+    JsonValue v;
+    BENCH("json_parse_async, in memory", json.size(), 20, [&] {
+        MemorySource source{json};
+        JsonTask<int> task = json_parse_async(source, v);
+        task.start();
+    });
+#if __has_include(<sys/socket.h>)
+    //The writer and the parser take turns on one thread, as in an event loop
+    BENCH("json_parse_async, socketpair", json.size(), 20, [&] {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        SocketSource source{fds[0]};
+        JsonTask<int> task = json_parse_async(source, v);
+        task.start();
+        size_t offset = 0;
+        while (!task.done())
+        {
+            if (offset < json.size())
+            {
+                ssize_t n = write(fds[1], json.data() + offset, json.size() - offset);
+                if (n > 0)
+                    offset += n;
+            }
+            else if (fds[1] >= 0)
+            {
+                close(fds[1]);
+                fds[1] = -1;
+            }
+            std::exchange(source.waiting, nullptr).resume();
+        }
+        close(fds[0]);
+        if (fds[1] >= 0)
+            close(fds[1]);
+    });
+#endif
+}
+
+static void bench_numbers()
+{
+    std::u8string json = make_records(10000);
+    JsonValue v;
+    JsonParseOptions options;
+    options.raw_numbers = true;
+    BENCH("parse + to_string", json.size(), 20, [&] { json_parse(v, json); v.to_string(); });
+    BENCH("parse + to_string, raw numbers", json.size(), 20, [&] { json_parse(v, json, options); v.to_string(); });
+}
+
+static void bench_transcode()
+{
+    std::u8string json = make_records(10000), out;
+    JsonValue v;
+    JsonFormat format;
+    format.indent = 2;
+    BENCH("parse + to_string", json.size(), 20, [&] { json_parse(v, json); out = v.to_string(); });
+    BENCH("transcode, minify", json.size(), 20, [&] { out.clear(); json_transcode(json, out); });
+    BENCH("transcode, pretty", json.size(), 20, [&] { out.clear(); json_transcode(json, out, format); });
+}
+
+static void bench_index()
+{
+    const size_t count = 50000;
+    std::u8string json = make_records(count);
+    JsonValue v;
+    json_parse(v, json);
+    double found = 0;
+    //Ids spread over the array, each benchmark iteration does 100 lookups
+    auto linear = [&] {
+        for (size_t id = 1; id <= count; id += count / 100)
+            for (auto &record : v.get_array())
+                if (record.get_object()[u8"Id"].get_number() == id)
+                {
+                    found += id;
+                    break;
+                }
+    };
+    auto indexed = [&](JsonIndex &index) {
+        return [&] {
+            for (size_t id = 1; id <= count; id += count / 100)
+                found += index.find(double(id)) ? id : 0;
+        };
+    };
+    JsonIndex hash(v, u8"/Id");
+    JsonIndex sorted(v, u8"/Id", JSON_INDEX_SORTED);
+    BENCH("100 lookups, linear scan", 0, 5, linear);
+    BENCH("100 lookups, hash index", 0, 200, indexed(hash));
+    BENCH("100 lookups, sorted index", 0, 200, indexed(sorted));
+    BENCH("build hash index", json.size(), 20, [&] { hash.rebuild(); });
+    BENCH("build sorted index", json.size(), 20, [&] { sorted.rebuild(); });
+    //Erasing one record only updates that record's entries
+    JsonValue record = v.get_array().back();
+    BENCH("100 erase + push_back, hash", 0, 20, [&] {
+        for (int i = 0; i < 100; i++)
+        {
+            hash.erase(count - 100);
+            hash.push_back(record);
+        }
+    });
+    if (found < 0)
+        printf("unreachable\n");
+}
+
+static void bench_batch()
+{
+    //Small independent bodies, as received by a gateway
+    std::vector<std::u8string> bodies;
+    for (size_t i = 0; i < 4096; i++)
+        bodies.push_back(make_records(1 + i % 8));
+    std::vector<std::u8string_view> inputs(bodies.begin(), bodies.end());
+    JsonBatchParser batch;
+    JsonParser parser;
+    std::vector<JsonBatchResult> results(inputs.size());
+
+    printf("%-12s %14s %14s %12s %12s\n", "batch size", "serial MB/s", "batch MB/s", "doc p50 us", "doc p99 us");
+    for (size_t size : {1, 16, 256, 4096})
+    {
+        std::span<const std::u8string_view> span(inputs.data(), size);
+        size_t bytes = 0;
+        for (auto input : span)
+            bytes += input.size();
+        const int rounds = std::max<int>(50, 40000 / size);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+            for (size_t i = 0; i < size; i++)
+                parser.parse(span[i], results[i].value);
+        std::chrono::duration<double> serial = std::chrono::steady_clock::now() - start;
+
+        //Every document of a batch arrives at its start, and is done when parsed
+        std::vector<std::chrono::steady_clock::time_point> done(size);
+        batch.parsed = [&](size_t i) { done[i] = std::chrono::steady_clock::now(); };
+        std::vector<double> latency;
+        double total = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            batch.parse(span, results);
+            std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+            total += elapsed.count();
+            for (auto end : done)
+                latency.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+        }
+        batch.parsed = nullptr;
+        std::sort(latency.begin(), latency.end());
+        printf("%-12zu %14.2f %14.2f %12.1f %12.1f\n", size, bytes * rounds / serial.count() / 1e6,
+               bytes * rounds / total, latency[latency.size() / 2], latency[latency.size() * 99 / 100]);
+    }
+}
+
+static void bench_cache()
+{
+    std::u8string json = make_records(100);
+    JsonValue v;
+    JsonSharedValue shared;
+    JsonParseCache cache(1 << 20);
+    uint64_t hash = 0;
+    BENCH("hash", json.size(), 2000, [&] { hash += json_hash_bytes(json); });
+    BENCH("parse, repeated input", json.size(), 2000, [&] { json_parse(v, json); });
+    BENCH("cached parse, repeated input", json.size(), 2000, [&] { cache.parse(json, shared); });
+    if (hash == 1)
+        printf("unreachable\n");
+}
+
+static void bench_bytes()
+{
+    std::u8string json = make_records(10000);
+    std::string text(json.begin(), json.end());
+    JsonValue v;
+    BENCH("std::string, copied to u8string", text.size(), 20, [&] { json_parse(v, std::u8string(text.begin(), text.end())); });
+    BENCH("std::string, in place", text.size(), 20, [&] { json_parse(v, text); });
+}
+
+static void bench_parallel_writer()
+{
+    std::u8string json = make_records(200000);
+    JsonValue v;
+    json_parse(v, json);
+    size_t bytes = v.to_string().size();
+    BENCH("to_string", bytes, 5, [&] { v.to_string(); });
+    for (unsigned threads : {1, 2, 4, 8})
+    {
+        JsonParallelWriter writer(threads);
+        std::string name = "parallel writer, " + std::to_string(threads) + " threads";
+        BENCH(name.c_str(), bytes, 5, [&] { writer.to_string(v); });
+        name = "parallel chunks, " + std::to_string(threads) + " threads";
+        BENCH(name.c_str(), bytes, 5, [&] { writer.to_chunks(v); });
+    }
+}
+
+static void bench_dedup()
+{
+    std::u8string json = make_records(10000);
+    JsonValue v, other;
+    json_parse(v, json);
+    json_parse(other, json);
+    JsonSharedValue shared(v), copy;
+    size_t before = shared.memory_usage(), saved = 0;
+    BENCH("JsonSharedValue from JsonValue", json.size(), 10, [&] { copy = JsonSharedValue(v); });
+    BENCH("dedup pass", json.size(), 10, [&] { copy = JsonSharedValue(v); saved = json_dedup(copy); });
+    printf("%-32s %10zu of %zu bytes\n", "dedup saved", saved, before);
+    JsonInterner interner;
+    BENCH("parse with interning", json.size(), 10, [&] { interner.clear(); json_parse(copy, json, interner); });
+    JsonSharedValue a(v), b(other);
+    bool equal = false;
+    BENCH("JsonValue ==", json.size(), 10, [&] { equal = v == other; });
+    BENCH("JsonSharedValue ==", json.size(), 10, [&] { equal = a == b; });
+    //Interned by one table, equal values are the same node
+    interner.clear();
+    interner.intern(a);
+    interner.intern(b);
+    BENCH("interned JsonSharedValue ==", json.size(), 10, [&] { equal = a == b; });
+    if (!equal)
+        printf("unreachable\n");
+}
+
+static void bench_patch()
+{
+    std::u8string json = make_records(100000);
+    JsonValue v, patch, merge, other;
+    json_parse(v, json);
+    json_parse(patch, u8"[{\"op\":\"replace\",\"path\":\"/500/Name\",\"value\":\"Patched\"},"
+                      u8"{\"op\":\"add\",\"path\":\"/-\",\"value\":{\"Id\":0}},{\"op\":\"remove\",\"path\":\"/100000\"},"
+                      u8"{\"op\":\"move\",\"from\":\"/7/Tags\",\"path\":\"/7/Labels\"},"
+                      u8"{\"op\":\"move\",\"from\":\"/7/Labels\",\"path\":\"/7/Tags\"}]");
+    json_parse(merge, u8"{\"Name\":\"Merged\",\"Active\":null}");
+    BENCH("to_string + parse (baseline)", json.size(), 5, [&] { json_parse(other, v.to_string()); });
+    BENCH("copy + JSON Patch", json.size(), 5, [&] { other = v; json_patch(other, patch); });
+    BENCH("JSON Patch in place", 0, 10000, [&] { json_patch(v, patch); });
+    BENCH("Merge Patch in place", 0, 10000, [&] { json_merge_patch(v.get_array()[500], merge); });
+    other = v;
+    json_patch(other, patch);
+    BENCH("diff, one change", json.size(), 5, [&] { json_diff(v, other); });
+}
+
+static void bench_limits()
+{
+    std::u8string json = make_records(100000);
+    JsonValue v;
+    json_parse(v, json);
+    JsonParseOptions options;
+    options.max_bytes = v.memory_usage().total();
+    options.max_values = SIZE_MAX - 1;
+    options.max_length = 1 << 20;
+    BENCH("parse", json.size(), 5, [&] { JsonValue fresh; json_parse(fresh, json); });
+    BENCH("parse with limits", json.size(), 5, [&] { JsonValue fresh; json_parse(fresh, json, options); });
+    JsonValue limited;
+    int ret = json_parse(limited, json, options);
+    printf("limited parse: %d, budget used exactly: %d\n", ret, limited.memory_usage().total() == options.max_bytes);
+    BENCH("memory_usage", 0, 20, [&] { v.memory_usage(); });
+}
+
+int main() {
+    bench_schema();
+    bench_events();
+    bench_async();
+    bench_numbers();
+    bench_transcode();
+    bench_index();
+    bench_batch();
+    bench_cache();
+    bench_bytes();
+    bench_parallel_writer();
+    bench_dedup();
+    bench_patch();
+    bench_limits();
+    return 0;
+}
@@ -1,10 +1,38 @@
 #pragma once
+#include <algorithm>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <cassert>
 #include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <concepts>
+#include <cstddef>
+#include <cstdio>
+#include <istream>
+#include <ranges>
+#if __has_include(<sys/uio.h>)
+#include <sys/uio.h>
+#endif
+#include <bit>
+#include <list>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
 
 namespace Json{
     enum JsonType{
@@ -17,10 +45,28 @@ namespace Json{
         JSON_OBJECT
     };
 
-    struct JsonContext{
-        std::u8string_view json;
+    // Heap bytes held by a tree, estimated from the sizes of its containers.
+    // Node and string buffer sizes follow libstdc++ (JSON_MEMBER_BYTES and
+    // json_string_heap()); other libraries are close but not exact, and no
+    // allocator overhead is counted. The root value itself is not included,
+    // it lives wherever its owner put it.
+    struct JsonMemoryUsage
+    {
+        //Every value but the root, in array slots and object members
+        size_t nodes = 0;
+        //Heap buffers of strings, raw numbers and keys
+        size_t strings = 0;
+        //Unused capacity of arrays
+        size_t arrays = 0;
+        //Tree links and keys of object members, without their values
+        size_t objects = 0;
+
+        size_t total() const { return nodes + strings + arrays + objects; }
+        JsonMemoryUsage &operator+=(const JsonMemoryUsage &);
     };
 
+    struct JsonContext;
+
     class JsonValue
     {
     public:
@@ -31,16 +77,26 @@ namespace Json{
         JsonValue(const std::vector<JsonValue> v) : number(0.0), array(v), type(JSON_ARRAY) {}
         JsonValue(std::map<std::u8string, JsonValue> &o) : number(0.0), object(o), type(JSON_OBJECT) {}
         JsonValue(const JsonValue&) = default;
-        bool operator==(const JsonValue& ) const = default;
+        JsonValue(JsonValue&&) = default;
+        JsonValue &operator=(const JsonValue&) = default;
+        JsonValue &operator=(JsonValue&&) = default;
+        bool operator==(const JsonValue& ) const;
 
         JsonType get_type();
         double get_number();
+        //Exact for integer raw numbers, others are truncated and saturate at
+        //the limits of the type; NaN gives 0
+        int64_t get_int64();
+        uint64_t get_uint64();
+        std::u8string get_number_text();
         std::u8string& get_string();
         std::vector<JsonValue>& get_array();
         std::map<std::u8string, JsonValue>& get_object();
 
         void set_type(JsonType);
+        void reset(JsonType);
         void set_number(double);
+        void set_raw_number(std::u8string_view);
         void set_string(const std::u8string&);
         void set_array(const std::vector<JsonValue>&);
         void set_object(const std::map<std::u8string, JsonValue>&);
@@ -53,16 +109,481 @@ namespace Json{
         JsonValue &operator=(const std::map<std::u8string, JsonValue>&);
 
         std::u8string to_string();
+        //Appends the output of to_string() to out
+        void write(std::u8string &out);
+        JsonMemoryUsage memory_usage() const;
 
     private:
+        friend class JsonSharedValue;
+        friend std::u8string json_index_key(const JsonValue &);
+        friend int64_t json_index_offset(const JsonValue &, double);
+        friend int json_parse_number(JsonContext &, JsonValue &);
+        friend class JsonValueBuilder;
+        double number_value() const;
         double number;
+        //Holds the original token of a raw number
         std::u8string text;
         std::vector<JsonValue> array;
         std::map<std::u8string, JsonValue> object;
         JsonType type;
+        bool raw_number = false;
+        bool number_ready = false;
+    };
+
+    // Heap bytes of the node of one object member: the tree links and colour,
+    // the key and the value. Long keys add their own buffer. Exact for
+    // libstdc++, an estimate elsewhere; libc++ and MSVC use the same links.
+    constexpr size_t JSON_MEMBER_BYTES = 4 * sizeof(void *) + sizeof(std::pair<const std::u8string, JsonValue>);
+#if defined(__GLIBCXX__)
+    static_assert(sizeof(std::_Rb_tree_node<std::pair<const std::u8string, JsonValue>>) == JSON_MEMBER_BYTES,
+                  "JSON_MEMBER_BYTES no longer matches the libstdc++ map node");
+#endif
+
+    // Identity of a schema for JsonParseCache. Every schema gets a new value,
+    // copies and assigned ones too, unlike an address that can be reused.
+    struct JsonSchemaId
+    {
+        uint64_t value = next();
+        JsonSchemaId() = default;
+        JsonSchemaId(const JsonSchemaId &) {}
+        JsonSchemaId &operator=(const JsonSchemaId &) { value = next(); return *this; }
+        static uint64_t next()
+        {
+            static std::atomic<uint64_t> counter = 0;
+            return ++counter;
+        }
+    };
+
+    // Compiled validator for a subset of JSON Schema: type, required,
+    // properties, items, enum, minimum, maximum, maxLength and
+    // additionalProperties. Other keywords are ignored.
+    struct JsonSchema
+    {
+        //One bit per JsonType, JSON_SCHEMA_INTEGER accepts integral numbers only
+        unsigned types = ~0u;
+        bool has_minimum = false;
+        bool has_maximum = false;
+        double minimum = 0.0;
+        double maximum = 0.0;
+        size_t max_length = SIZE_MAX;
+        std::vector<JsonValue> enumeration;
+        std::vector<std::u8string> required;
+        std::map<std::u8string, JsonSchema, std::less<>> properties;
+        std::shared_ptr<const JsonSchema> items;
+        std::shared_ptr<const JsonSchema> additional;
+        bool additional_allowed = true;
+        JsonSchemaId id;
+    };
+    constexpr unsigned JSON_SCHEMA_INTEGER = 1u << (JSON_OBJECT + 1);
+
+    // Where the first violation was found. The offset is only set when
+    // validating during the parse.
+    struct JsonSchemaError
+    {
+        std::u8string path;
+        size_t offset = 0;
+    };
+
+    // Byte types a document can be parsed from. They are all read as char8_t
+    // in place, the input is never converted or copied.
+    template<typename T>
+    concept JsonChar = std::same_as<T, char> || std::same_as<T, unsigned char> ||
+                       std::same_as<T, char8_t> || std::same_as<T, std::byte>;
+
+    // Contiguous containers and views of JsonChar: std::string, std::vector<char>,
+    // std::span<const std::byte>... Arrays are excluded so that a string literal
+    // is not parsed with its terminating '\0'.
+    template<typename R>
+    concept JsonBytes = std::ranges::contiguous_range<const R> && std::ranges::sized_range<const R> &&
+                        JsonChar<std::ranges::range_value_t<const R>> && !std::is_array_v<R>;
+
+    template<JsonChar C>
+    std::u8string_view json_as_u8(const C *data, size_t size)
+    {
+        return std::u8string_view(reinterpret_cast<const char8_t *>(data), size);
+    }
+
+    template<JsonBytes R>
+    std::u8string_view json_as_u8(const R &bytes)
+    {
+        return json_as_u8(std::ranges::data(bytes), std::ranges::size(bytes));
+    }
+
+    // Budget charged by the parser before it grows the tree. It is not an
+    // allocator: the containers still allocate through std::allocator, and
+    // bytes is what the growth adds to JsonValue::memory_usage(), with the
+    // same layout-dependent estimates. Returning false aborts the parse with
+    // PARSE_LIMIT_EXCEEDED before the allocation.
+    class JsonMemoryBudget
+    {
+    public:
+        virtual ~JsonMemoryBudget() = default;
+        virtual bool charge(size_t bytes) = 0;
+    };
+
+    struct JsonParseOptions
+    {
+        const JsonSchema *schema = nullptr;
+        JsonSchemaError *schema_error = nullptr;
+        //Keep numbers as their original text, converted on first access
+        bool raw_numbers = false;
+        //Limits checked before each allocation: the bytes the tree grows by
+        //as memory_usage() estimates them, the number of values, and the
+        //length of a string, key, array or object. Storage a value reuses
+        //from the same place in the destination is not counted, the growth
+        //of the parser's scratch key is. Object members left over from other
+        //keys or documents are not recycled under limits.
+        size_t max_bytes = SIZE_MAX;
+        size_t max_values = SIZE_MAX;
+        size_t max_length = SIZE_MAX;
+        JsonMemoryBudget *memory_budget = nullptr;
+
+        bool limited() const
+        {
+            return max_bytes != SIZE_MAX || max_values != SIZE_MAX || max_length != SIZE_MAX || memory_budget;
+        }
+    };
+
+    struct JsonContext{
+        std::u8string_view json;
+        std::u8string_view source;
+        //Schema of the value being parsed and its JSON Pointer
+        const JsonSchema *schema = nullptr;
+        JsonSchemaError *schema_error = nullptr;
+        std::u8string path;
+        bool raw_numbers = false;
+        //Limits and usage of the current parse, only tracked when limited
+        bool limited = false;
+        size_t max_bytes = SIZE_MAX;
+        size_t max_values = SIZE_MAX;
+        size_t max_length = SIZE_MAX;
+        JsonMemoryBudget *memory_budget = nullptr;
+        size_t bytes = 0;
+        size_t values = 0;
+        //Scratch storage, kept alive between documents by JsonParser
+        std::u8string key;
+        std::vector<std::map<std::u8string, JsonValue>::node_type> nodes;
+    };
+
+    // Reusable parser. It keeps its scratch buffers between calls and reuses
+    // the allocations of the destination tree where the shapes match. Object
+    // members left over by one document are pooled, with their subtrees, for
+    // the next ones; shrink() releases the pool and the scratch buffers.
+    class JsonParser
+    {
+    public:
+        int parse(std::u8string_view, JsonValue &, const JsonParseOptions & = JsonParseOptions());
+        template<JsonBytes R>
+        int parse(const R &json, JsonValue &v, const JsonParseOptions &options = JsonParseOptions())
+        {
+            return parse(json_as_u8(json), v, options);
+        }
+        int parse(const char *json, JsonValue &v, const JsonParseOptions &options = JsonParseOptions())
+        {
+            return parse(json_as_u8(json, strlen(json)), v, options);
+        }
+        void shrink();
+
+    private:
+        JsonContext context;
+    };
+
+    class JsonInterner;
+
+    // Immutable, reference counted JSON value. Copies are O(1) and share their
+    // subtrees; the mutation methods copy only the nodes on the modified path.
+    // Reading one value from many threads is safe, every thread mutating its
+    // own copy is safe too.
+    class JsonSharedValue
+    {
+    public:
+        JsonSharedValue() = default;
+        JsonSharedValue(JsonType);
+        JsonSharedValue(double);
+        JsonSharedValue(const char8_t *);
+        JsonSharedValue(const JsonValue &);
+
+        JsonType get_type() const;
+        double get_number() const;
+        const std::u8string &get_string() const;
+        const std::vector<JsonSharedValue> &get_array() const;
+        const std::map<std::u8string, JsonSharedValue, std::less<>> &get_object() const;
+        size_t size() const;
+        const JsonSharedValue &operator[](size_t) const;
+        const JsonSharedValue *find(std::u8string_view) const;
+
+        JsonSharedValue &set(size_t, JsonSharedValue);
+        JsonSharedValue &set(std::u8string_view, JsonSharedValue);
+        JsonSharedValue &push_back(JsonSharedValue);
+        bool erase(std::u8string_view);
+        JsonSharedValue &modify(size_t);
+        JsonSharedValue &modify(std::u8string_view);
+
+        bool is_same(const JsonSharedValue &) const;
+        //Skips shared subtrees. Cached hashes are not used, so it stays right
+        //after a change through modify().
+        bool operator==(const JsonSharedValue &) const;
+        //Structural hash, consistent with operator==. It is cached in the
+        //nodes and modify() resets the parent's, so a reference returned by
+        //modify() must not be changed after calling hash() on one of its
+        //parents.
+        uint64_t hash() const;
+        JsonValue to_value() const;
+        std::u8string to_string() const;
+        //Appends the output of to_string() to out, as JsonValue::write() does
+        void write(std::u8string &out) const;
+        //Approximate heap bytes, shared subtrees are counted in every holder
+        size_t memory_usage() const;
+
+    private:
+        friend class JsonInterner;
+        friend int json_parse_shared(JsonSharedValue &, std::u8string_view, JsonInterner *, bool);
+        struct Node;
+        Node &detach();
+        size_t node_usage() const;
+        std::shared_ptr<Node> node;
+    };
+
+    // Hash-consing table. intern() makes a value share every subtree and
+    // string equal to one interned before, so repeated objects, arrays and
+    // strings are stored once. Raw numbers are only shared with the same text.
+    // The table keeps its values alive until clear().
+    class JsonInterner
+    {
+    public:
+        void intern(JsonSharedValue &v);
+        //Bytes released by sharing, estimated like memory_usage()
+        size_t bytes_saved() const { return saved; }
+        //Distinct values in the table
+        size_t size() const { return values.size(); }
+        void clear();
+
+    private:
+        //Shallow comparison, the children are already interned. Numbers are
+        //compared by bit pattern, so -0 and 0 stay apart.
+        static bool identical(const JsonSharedValue &, const JsonSharedValue &);
+        //hash() with the bits of a number, which hash() maps -0 to 0 for
+        static uint64_t key(const JsonSharedValue &);
+
+        std::unordered_multimap<uint64_t, JsonSharedValue> values;
+        size_t saved = 0;
+    };
+
+    // Deduplicates the subtrees of v, returns the bytes saved.
+    size_t json_dedup(JsonSharedValue &v);
+
+    enum JsonIndexType
+    {
+        //Equality lookups in O(1)
+        JSON_INDEX_HASH,
+        //Equality lookups in O(log n) and range queries
+        JSON_INDEX_SORTED,
+    };
+
+    // Secondary index over an array of objects, keyed by the scalar at a JSON
+    // Pointer inside each element. Elements without that member, or with an
+    // array or object there, are not indexed.
+    // Changes made through push_back(), set() and erase() keep the index up to
+    // date. Other changes to the array are detected when its size or storage
+    // moves and the index is rebuilt on the next lookup; editing a key in place
+    // requires calling rebuild(). erase() only updates the entry of the erased
+    // element.
+    class JsonIndex
+    {
+    public:
+        JsonIndex(JsonValue &array, std::u8string_view pointer, JsonIndexType type = JSON_INDEX_HASH);
+        void rebuild();
+        bool stale();
+
+        //An element whose key equals key, nullptr if there is none
+        JsonValue *find(const JsonValue &key);
+        std::vector<JsonValue *> find_all(const JsonValue &key);
+        //Elements with low <= key <= high in key order, sorted indexes only
+        std::vector<JsonValue *> range(const JsonValue &low, const JsonValue &high);
+
+        void push_back(JsonValue v);
+        void set(size_t index, JsonValue v);
+        void erase(size_t index);
+
+    private:
+        void insert(size_t index, size_t slot);
+        void remove(size_t index, size_t slot);
+        bool key_of(size_t index, std::u8string &key);
+        size_t position(size_t slot) const;
+        size_t slot_at(size_t position) const;
+        void add_slot();
+        void erase_slot(size_t slot);
+
+        JsonValue *array;
+        std::u8string pointer;
+        JsonIndexType type;
+        //Entries refer to slots, which number the elements in the order they
+        //were added and do not move when an element before them is erased
+        std::unordered_multimap<std::u8string, size_t> hash;
+        std::multimap<std::u8string, size_t> sorted;
+        //Entry of each slot, for those with a key
+        std::vector<std::unordered_multimap<std::u8string, size_t>::iterator> hash_entries;
+        std::vector<std::multimap<std::u8string, size_t>::iterator> sorted_entries;
+        //Fenwick tree over the slots, 1 for the live ones and 0 for erased
+        std::vector<size_t> live;
+        size_t erased = 0;
+        //Shape of the array when the index was last synchronized
+        size_t size = 0;
+        const JsonValue *data = nullptr;
+    };
+
+    // Work-stealing thread pool. Each run() call deals its tasks round-robin to
+    // per-worker deques; workers pop their own from the back and steal from
+    // the front of the others.
+    class JsonThreadPool
+    {
+    public:
+        //0 uses one worker per hardware thread; the calling thread is one of them
+        explicit JsonThreadPool(unsigned threads = 0);
+        ~JsonThreadPool();
+        JsonThreadPool(const JsonThreadPool &) = delete;
+        JsonThreadPool &operator=(const JsonThreadPool &) = delete;
+
+        size_t size() const { return workers.size(); }
+        //Calls task(worker, index) for every index below count, then returns
+        void run(size_t count, const std::function<void(size_t, size_t)> &task);
+
+    private:
+        struct Worker
+        {
+            std::mutex lock;
+            std::deque<size_t> tasks;
+            std::thread thread;
+        };
+
+        void loop(size_t worker);
+        void work(size_t worker);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::mutex lock;
+        std::condition_variable wake, done;
+        size_t generation = 0;
+        size_t busy = 0;
+        bool stopping = false;
+        const std::function<void(size_t, size_t)> *current = nullptr;
+    };
+
+    struct JsonBatchResult
+    {
+        JsonValue value;
+        int error = 0;
+    };
+
+    // Parses many independent documents on a JsonThreadPool. Each worker keeps
+    // its own JsonParser, so scratch buffers and recycled nodes stay with one
+    // thread, and the results of the previous batch are parsed into where the
+    // shapes match. Small documents are grouped into tasks of about task_bytes.
+    class JsonBatchParser
+    {
+    public:
+        explicit JsonBatchParser(unsigned threads = 0);
+
+        //Returns PARSE_OK, or the error of the first document that failed.
+        //options.schema_error is not filled in.
+        int parse(std::span<const std::u8string_view> inputs, std::vector<JsonBatchResult> &results,
+                  const JsonParseOptions &options = JsonParseOptions());
+
+        size_t task_bytes = 16 * 1024;
+        //Called on the worker thread as soon as the document at index is parsed
+        std::function<void(size_t index)> parsed;
+
+    private:
+        JsonThreadPool pool;
+        std::vector<JsonParser> parsers;
+        //Half-open ranges of documents
+        std::vector<std::pair<size_t, size_t>> tasks;
+    };
+
+    // Serializes large trees on a JsonThreadPool, with output identical to
+    // JsonValue::to_string(). Arrays and objects with at least 2 * min_group
+    // children are split into groups written to separate buffers; smaller
+    // containers near the root are descended into, deeper ones are written
+    // whole by one task. A min_group of 0 is treated as 1.
+    class JsonParallelWriter
+    {
+    public:
+        explicit JsonParallelWriter(unsigned threads = 0);
+        std::u8string to_string(JsonValue &v);
+        //The output as ordered chunks, valid until the next call
+        const std::vector<std::u8string_view> &to_chunks(JsonValue &v);
+
+        size_t min_group = 64;
+
+    private:
+        struct Task
+        {
+            //A whole value, a range of array elements or of object members
+            JsonValue *value = nullptr;
+            std::vector<JsonValue>::iterator first, last;
+            std::map<std::u8string, JsonValue>::iterator first_member, last_member;
+            std::u8string out;
+        };
+
+        void plan(JsonValue &v, int depth);
+        void add_task();
+
+        JsonThreadPool pool;
+        //The output is literals[0] tasks[0] literals[1] ... literals[task_count]
+        std::vector<Task> tasks;
+        std::vector<std::u8string> literals;
+        size_t task_count = 0;
+        std::vector<std::u8string_view> chunks;
     };
 
+#if __has_include(<sys/uio.h>)
+    // Chunks of JsonParallelWriter::to_chunks() as an argument for writev()
+    std::vector<iovec> json_iovecs(const std::vector<std::u8string_view> &);
+#endif
 
+    struct JsonCacheStats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        //Input bytes plus the estimated size of the cached values
+        size_t bytes = 0;
+    };
+
+    // Bounded LRU cache of parse results, keyed by a hash of the input. A hash
+    // match is confirmed by comparing the bytes. Cached values are immutable
+    // and shared by every caller that parsed the same input. Only successful
+    // parses are cached. Options with limits or a memory budget bypass the cache.
+    // A schema is keyed by its id, which every compile or copy renews.
+    // All methods are thread safe; parsing happens outside the lock.
+    class JsonParseCache
+    {
+    public:
+        explicit JsonParseCache(size_t budget_bytes);
+        int parse(std::u8string_view json, JsonSharedValue &v, const JsonParseOptions &options = JsonParseOptions());
+        JsonCacheStats stats() const;
+        void clear();
+
+    private:
+        struct Entry
+        {
+            uint64_t hash;
+            std::u8string json;
+            //Options that change the result, the schema by its id
+            uint64_t schema;
+            bool raw_numbers;
+            JsonSharedValue value;
+            size_t bytes;
+        };
+        std::list<Entry>::iterator find(uint64_t hash, std::u8string_view json, const JsonParseOptions &options);
+
+        size_t budget;
+        mutable std::mutex lock;
+        //Most recently used first
+        std::list<Entry> entries;
+        std::unordered_multimap<uint64_t, std::list<Entry>::iterator> by_hash;
+        JsonCacheStats counters;
+    };
 
     // Parse result
     enum
@@ -83,555 +604,4347 @@ namespace Json{
         PARSE_INVALID_OBJECT_SEPARATOR,
         PARSE_INVALID_OBJECT_VALUE,
         PARSE_EXTRA_OBJECT_SEPARATOR,
+        PARSE_SCHEMA_VIOLATION,
+        PARSE_INVALID_SCHEMA,
+        PARSE_INVALID_PATCH,
+        PARSE_PATCH_PATH_NOT_FOUND,
+        PARSE_PATCH_TEST_FAILED,
+        PARSE_LIMIT_EXCEEDED,
+        //A number out of the range of a double, unless kept raw
+        PARSE_NUMBER_TOO_BIG,
     };
 
-    int json_parse(JsonValue &, std::u8string_view);
+    int json_parse(JsonValue &, std::u8string_view, const JsonParseOptions & = JsonParseOptions());
+    int json_parse(JsonContext &, JsonValue &, std::u8string_view, const JsonParseOptions &);
+    int json_parse(JsonValue &, const char *, const JsonParseOptions & = JsonParseOptions());
+    // Documents read through a fixed window of window bytes
+    int json_parse(JsonValue &, std::istream &, const JsonParseOptions & = JsonParseOptions(), size_t window = 4096);
+    int json_parse(JsonValue &, FILE *, const JsonParseOptions & = JsonParseOptions(), size_t window = 4096);
+    // Builds a JsonSharedValue and interns every value as soon as it is
+    // complete, so duplicates are released while parsing
+    int json_parse(JsonSharedValue &, std::u8string_view, JsonInterner &, bool raw_numbers = false);
+    // Builds the shared nodes straight from the parse events. A schema or
+    // limits are applied by parsing into a JsonValue first.
+    int json_parse(JsonSharedValue &, std::u8string_view, const JsonParseOptions & = JsonParseOptions());
+    int json_parse_shared(JsonSharedValue &, std::u8string_view, JsonInterner *, bool raw_numbers);
+
+    template<JsonBytes R>
+    int json_parse(JsonValue &v, const R &json, const JsonParseOptions &options = JsonParseOptions())
+    {
+        return json_parse(v, json_as_u8(json), options);
+    }
     void json_parse_whitespace(JsonContext&);
     int json_parse_value(JsonContext&, JsonValue&);
     int json_parse_literal(JsonContext &, JsonValue &, std::u8string_view, JsonType);
     int json_parse_number(JsonContext &, JsonValue &);
-    int json_parse_string_raw(JsonContext &, std::u8string&, size_t&);
+    int json_parse_string_raw(JsonContext &, std::u8string&, size_t&, bool charged = false);
+    bool json_charge(JsonContext &, size_t);
+    bool json_reserve_string(JsonContext &, std::u8string &, size_t);
+    bool json_reserve_array(JsonContext &, std::vector<JsonValue> &);
+    size_t json_string_heap(size_t capacity);
     int json_parse_string(JsonContext &, JsonValue &);
     int json_parse_array(JsonContext &, JsonValue &);
     int json_parse_object(JsonContext &, JsonValue &);
+    // Error of an object member from the error of its value. Only syntax
+    // errors become PARSE_INVALID_OBJECT_VALUE.
+    int json_member_error(int);
     std::u8string json_encode_utf8(unsigned);
+    double json_decode_number(std::u8string_view);
+    // Compares two numbers by value. A raw integer token, given as a or b's
+    // text, is compared exactly with the other number instead of through
+    // its double, so that equality stays transitive.
+    bool json_number_equal(double a, std::u8string_view a_text, double b, std::u8string_view b_text);
+    int json_compile_schema(JsonSchema &, JsonValue &);
+    int json_validate(const JsonSchema &, JsonValue &, JsonSchemaError * = nullptr);
+    bool json_schema_check(const JsonSchema &, JsonValue &);
+    bool json_schema_check_start(const JsonSchema &, char8_t);
+    int json_schema_violation(JsonContext &, const char8_t *);
+    void json_append_pointer(std::u8string &, std::u8string_view);
+    void json_encode_string(std::u8string &, std::u8string_view, bool ascii = true);
+    JsonValue *json_find_pointer(JsonValue &, std::u8string_view);
+    bool json_pointer_unescape(std::u8string_view, std::u8string &);
+    bool json_pointer_index(std::u8string_view, size_t &);
+    std::u8string json_index_key(const JsonValue &);
+    // Exact value of a 64-bit raw integer minus its double n, 0 otherwise
+    int64_t json_index_offset(const JsonValue &, double n);
+    uint64_t json_hash_bytes(std::u8string_view);
+    // Writers shared by JsonValue, JsonSharedValue and JsonParallelWriter, so
+    // that they give the same output. text is a string's contents, or the
+    // token of a raw number.
+    void json_write_scalar(std::u8string &, JsonType, double number, std::u8string_view text, bool raw_number);
+    template<typename It>
+    void json_write_elements(std::u8string &, It first, It last);
+    template<typename It>
+    void json_write_members(std::u8string &, It first, It last);
 
-
-    int json_parse(JsonValue &v, std::u8string_view json)
+    // Minimal C++20 generator, iterated with a range-for loop.
+    template<typename T>
+    class JsonGenerator
     {
-        JsonContext c;
-        c.json = json;
+    public:
+        struct promise_type
+        {
+            T *value = nullptr;
+            JsonGenerator get_return_object() { return JsonGenerator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            std::suspend_always yield_value(T &v) noexcept { value = &v; return {}; }
+            std::suspend_always yield_value(T &&v) noexcept { value = &v; return {}; }
+            void return_void() {}
+            void unhandled_exception() { throw; }
+        };
 
-        v.set_type(JSON_NULL);
-        json_parse_whitespace(c);
-        int ret;
-        if((ret = json_parse_value(c, v)) == PARSE_OK)
+        class iterator
         {
-            json_parse_whitespace(c);
-            if(!c.json.empty())
+        public:
+            explicit iterator(std::coroutine_handle<promise_type> h) : handle(h) {}
+            T &operator*() const { return *handle.promise().value; }
+            iterator &operator++() { handle.resume(); return *this; }
+            bool operator==(std::default_sentinel_t) const { return handle.done(); }
+
+        private:
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        JsonGenerator(JsonGenerator &&g) noexcept : handle(std::exchange(g.handle, nullptr)) {}
+        ~JsonGenerator() { if(handle) handle.destroy(); }
+        iterator begin() { handle.resume(); return iterator(handle); }
+        std::default_sentinel_t end() { return {}; }
+        //Resumes the coroutine, false once it has finished
+        bool next() { handle.resume(); return !handle.done(); }
+        T &value() { return *handle.promise().value; }
+
+    private:
+        explicit JsonGenerator(std::coroutine_handle<promise_type> h) : handle(h) {}
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    // Lazily started coroutine returning T. It can be co_awaited, or started
+    // with start() and polled with done() by an event loop.
+    template<typename T>
+    class JsonTask
+    {
+    public:
+        struct promise_type
+        {
+            T value{};
+            std::coroutine_handle<> continuation;
+            JsonTask get_return_object() { return JsonTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            auto final_suspend() noexcept
             {
-                v.set_type(JSON_NULL);
-                ret = PARSE_ROOT_NOT_SINGULAR;
+                struct awaiter
+                {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                    {
+                        auto continuation = h.promise().continuation;
+                        return continuation ? continuation : std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return awaiter{};
             }
+            void return_value(T v) { value = std::move(v); }
+            void unhandled_exception() { throw; }
+        };
+
+        JsonTask(JsonTask &&t) noexcept : handle(std::exchange(t.handle, nullptr)) {}
+        ~JsonTask() { if(handle) handle.destroy(); }
+
+        void start() { handle.resume(); }
+        bool done() const { return handle.done(); }
+        T &get() { assert(done()); return handle.promise().value; }
+
+        bool await_ready() const { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h)
+        {
+            handle.promise().continuation = h;
+            return handle;
         }
-        return ret;
-    }
+        T await_resume() { return std::move(handle.promise().value); }
 
-    void json_parse_whitespace(JsonContext &context)
+    private:
+        explicit JsonTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    enum JsonEventType
     {
-        int i = 0;
-        const std::u8string_view &json = context.json;
-        while(json[i] == ' ' || json[i] ==  '\t' || json[i] == '\n' || json[i] == '\r')
-            i++;
-        context.json = json.substr(i);
-    }
+        JSON_EVENT_NULL,
+        JSON_EVENT_FALSE,
+        JSON_EVENT_TRUE,
+        JSON_EVENT_NUMBER,
+        JSON_EVENT_STRING,
+        JSON_EVENT_KEY,
+        JSON_EVENT_BEGIN_ARRAY,
+        JSON_EVENT_END_ARRAY,
+        JSON_EVENT_BEGIN_OBJECT,
+        JSON_EVENT_END_OBJECT,
+        JSON_EVENT_NEED_MORE,
+        JSON_EVENT_ERROR
+    };
 
-    int json_parse_value(JsonContext& context, JsonValue &value)
+    struct JsonEvent
     {
-        switch(*context.json.begin())
-        {
-            case u8'n':
-                return json_parse_literal(context, value, u8"null", JSON_NULL);
-            case u8'f':
-                return json_parse_literal(context, value, u8"false", JSON_FALSE);
-            case u8't':
-                return json_parse_literal(context, value, u8"true", JSON_TRUE);
-            case u8'\"':
-                return json_parse_string(context, value);
-            case u8'[':
-                return json_parse_array(context, value);
-            case u8'{':
-                return json_parse_object(context, value);
-            case u8'\0':
-                return PARSE_EXPECT_VALUE;
-            default:
-                return json_parse_number(context, value);
-        }
+        JsonEventType type = JSON_EVENT_NULL;
+        //Decoded string or key, raw number. Valid until the next event.
+        std::u8string_view text;
+        int error = PARSE_OK;
+    };
 
-    }
+    // Input of json_events(). A chunk passed to feed() must stay valid until
+    // the parser yields JSON_EVENT_NEED_MORE, close() marks the end of input.
+    struct JsonInput
+    {
+        std::u8string_view json;
+        bool closed = false;
+        //Longest string or number copied out of the chunks it spans; a longer
+        //one stops the events with PARSE_LIMIT_EXCEEDED
+        size_t max_token = SIZE_MAX;
 
-    int json_parse_literal(JsonContext &c, JsonValue &v, const std::u8string_view literal, JsonType type)
+        void feed(std::u8string_view chunk) { json = chunk; }
+        void close() { closed = true; }
+    };
+
+    // Builds a JsonValue from parse events. Built with JsonParseOptions, it
+    // enforces their limits as json_parse() does; the schema is left to the
+    // caller, since it can only be checked on the complete value.
+    class JsonValueBuilder
     {
-        if(!c.json.starts_with(literal))
-            return PARSE_INVALID_VALUE;
-        v.set_type(type);
-        c.json = c.json.substr(literal.length());
-        return PARSE_OK;
-    }
+    public:
+        explicit JsonValueBuilder(JsonValue &v, bool raw_numbers = false) : root(&v), raw_numbers(raw_numbers) {}
+        JsonValueBuilder(JsonValue &v, const JsonParseOptions &options);
+        //Starts the next value, with fresh limits
+        void reset(JsonValue &v);
+        //Returns true when a top-level value is complete
+        bool add(const JsonEvent &);
+        //PARSE_LIMIT_EXCEEDED once a limit is broken, or PARSE_NUMBER_TOO_BIG;
+        //later events are ignored
+        int error() const { return ret; }
 
-    int json_parse_number(JsonContext &c, JsonValue &v)
+    private:
+        JsonValue *next();
+        bool exceeded();
+        JsonValue *root;
+        bool raw_numbers;
+        std::vector<JsonValue *> stack;
+        std::u8string key;
+        //Depth inside the value of a repeated key, whose events are dropped
+        size_t skip = 0;
+        //Limits and usage, as in json_parse()
+        JsonContext limits;
+        int ret = PARSE_OK;
+    };
+
+    // Longest token that can hold a string or number within the limits of
+    // options: an escape takes up to six bytes for one, plus the quotes
+    size_t json_max_token(const JsonParseOptions &);
+
+    //What json_events() expects next
+    enum JsonEventState
+    {
+        JSON_EXPECT_VALUE,
+        JSON_EXPECT_KEY,
+        JSON_EXPECT_NEXT
+    };
+    bool json_is_whitespace(char8_t);
+    JsonEvent &json_event_error(JsonEvent &, const std::vector<char8_t> &, int, size_t);
+    JsonGenerator<JsonEvent> json_events(JsonInput &, bool multiple = false);
+    JsonGenerator<JsonEvent> json_events(std::u8string_view);
+
+    // Constant-evaluable pieces of the parser, shared by json_parse() and the
+    // compile-time parser below.
+    constexpr size_t json_scan_number(std::u8string_view json)
     {
-        //validate number
-        size_t number_length = 0;
+        //validate number, return its length or 0 when invalid
+        auto is_digital = [](const char ch) { return ch >= u8'0' && ch <= u8'9'; };
+        auto is_digital_1to9 = [](const char ch) { return ch >= u8'1' && ch <= u8'9'; };
+        size_t current = 0;
+        auto peek = [&json, &current]() { return current < json.length() ? json[current] : u8'\0'; };
+        /* negative part */
+        if(peek() == u8'-')
+            ++current;
+
+        /* integer part */
+        if(is_digital_1to9(peek()))
         {
-            auto is_digital = [](const char ch) { return ch >= u8'0' && ch <= u8'9'; };
-            auto is_digital_1to9 = [](const char ch) { return ch >= u8'1' && ch <= u8'9'; };
-            auto current = c.json.begin();
-            /* negative part */
-            if(*current == u8'-')
-                ++current;
-            
-            /* integer part */
-            if(is_digital_1to9(*current))
-            {
-                while(is_digital(*current))
-                    ++current;
-            }
-            else if(*current == u8'0')
-            {
+            while(is_digital(peek()))
                 ++current;
-            }
-            else
-                return PARSE_INVALID_VALUE;
+        }
+        else if(peek() == u8'0')
+        {
+            ++current;
+        }
+        else
+            return 0;
 
-            /* decimal part */
-            if(*current == '.')
-            {
-                ++current;
-                //Must have one digital after .
-                if(!is_digital(*current))
-                    return PARSE_INVALID_VALUE;
+        /* decimal part */
+        if(peek() == '.')
+        {
+            ++current;
+            //Must have one digital after .
+            if(!is_digital(peek()))
+                return 0;
 
-                while (is_digital(*current))
-                    ++current;
-            }
-            /* index part */
-            if(*current == u8'e' || *current == u8'E')
-            {
+            while (is_digital(peek()))
                 ++current;
-                if(*current == u8'-' || *current == u8'+')
-                    ++current;
-                while(is_digital(*current))
-                    ++current;
-            }
-            /* validate end */
-            /*
-            if(!is_whitespace_or_end(*current))
-                return PARSE_INVALID_VALUE;
-                */
+        }
+        /* index part */
+        if(peek() == u8'e' || peek() == u8'E')
+        {
+            ++current;
+            if(peek() == u8'-' || peek() == u8'+')
+                ++current;
+            while(is_digital(peek()))
+                ++current;
+        }
+        return current;
+    }
 
-            number_length = current - c.json.begin();
+    // Value of the 4 hex digits at pos, -1 if they are not valid.
+    constexpr int json_hex4(std::u8string_view json, size_t pos)
+    {
+        if(pos + 4 > json.length())
+            return -1;
+        int codepoint = 0;
+        for(size_t i = pos; i < pos + 4; i++)
+        {
+            char8_t ch = json[i];
+            if(ch >= u8'0' && ch <= u8'9')
+                codepoint = codepoint * 16 + (ch - u8'0');
+            else if(ch >= u8'a' && ch <= u8'f')
+                codepoint = codepoint * 16 + (ch - u8'a' + 10);
+            else if(ch >= u8'A' && ch <= u8'F')
+                codepoint = codepoint * 16 + (ch - u8'A' + 10);
+            else
+                return -1;
         }
-        v.set_number(std::stod(std::string(c.json.begin(), c.json.begin() + number_length)));
-        v.set_type(JSON_NUMBER);
-        c.json = c.json.substr(number_length);
-        return PARSE_OK;
+        return codepoint;
+    }
+
+    // Writes the UTF-8 bytes of codepoint to buffer, returns their count.
+    constexpr size_t json_encode_utf8(unsigned codepoint, char8_t *buffer)
+    {
+        assert(codepoint <= 0x10FFFF);
+        //U+0000~U+007F -> 1 byte: 0xxx xxxx
+        if(codepoint <= 0x007F)
+        {
+            buffer[0] = codepoint & 0x7F;                   //0x7F = 0111 1111
+            return 1;
+        }
+        //U+0080~U+07FF-> 2 bytes: 110x xxxx, 10yy yyyy
+        if(codepoint <= 0x07FF)
+        {
+            buffer[0] = 0xC0 | ((codepoint >> 6) & 0x1F);   //0xC0 = 1100 0000, 0x1F = 0001 1111
+            buffer[1] = 0x80 | ( codepoint       & 0x3F);   //0x80 = 1000 0000, 0x3F = 0011 1111
+            return 2;
+        }
+        //U+0800~U+FFFF-> 3 bytes: 1110 xxxx, 10yy yyyy, 10zz zzzz
+        if(codepoint <= 0xFFFF)
+        {
+            buffer[0] = 0xE0 | ((codepoint >> 12) & 0x0F);   //0xE0 = 1110 0000, 0x0F = 0000 1111
+            buffer[1] = 0x80 | ((codepoint >>  6) & 0x3F);   //0x80 = 1000 0000, 0x3F = 0011 1111
+            buffer[2] = 0x80 | ( codepoint        & 0x3F);   //0x80 = 1000 0000, 0x3F = 0011 1111
+            return 3;
+        }
+        //U+10000~U+10FFFFF-> 4 bytes: 1111 0xxx, 10yy yyyy, 10zz zzzz, 10mm mmmm
+        buffer[0] = 0xF0 | ((codepoint >> 18) & 0x07);   //0xF0 = 1111 0000, 0x07 = 0000 0111
+        buffer[1] = 0x80 | ((codepoint >> 12) & 0x3F);   //0x80 = 1000 0000, 0x3F = 0011 1111
+        buffer[2] = 0x80 | ((codepoint >>  6) & 0x3F);   //0x80 = 1000 0000, 0x3F = 0011 1111
+        buffer[3] = 0x80 | ( codepoint        & 0x3F);   //0x80 = 1000 0000, 0x3F = 0011 1111
+        return 4;
     }
 
-    int json_parse_string_raw(JsonContext &c, std::u8string &str, size_t& end_pos)
+    // Decodes the string starting at the quotation json[0], passing each byte
+    // to push. end_pos is set past the closing quotation.
+    template<typename Push>
+    constexpr int json_decode_string(std::u8string_view json, size_t &end_pos, Push push)
     {
-        for (auto i = c.json.begin() + 1; i != c.json.end(); i++)
+        auto peek = [&json](size_t i) { return i < json.length() ? json[i] : u8'\0'; };
+        size_t i = 1;
+        while(i < json.length())
         {
-            //Another quotation
-            if(*i == '\"' && *(i-1) != '\\')
+            char8_t ch = json[i++];
+            //Another quotation, escaped ones are consumed below
+            if(ch == u8'\"')
             {
-                end_pos = i - c.json.begin() + 1;
-                break;
+                end_pos = i;
+                return PARSE_OK;
             }
-
-            if(static_cast<unsigned char>(*i) < 0x20)
+            if(ch < 0x20)
                 return PARSE_INVALID_STRING_CHAR;
-
-            if(*i == u8'\\')
-            //Todo: parse Unicode
+            if(ch != u8'\\')
             {
-                switch(*(++i))
-                {
-                case u8'\\':
-                    str.push_back(u8'\\');
-                    break;
-                case u8'\"':
-                    str.push_back(u8'\"');
-                    break;
-                case u8'/':
-                    str.push_back(u8'/');
-                    break;
-                case u8'b':
-                    str.push_back(u8'\b');
-                    break;
-                case u8'f':
-                    str.push_back(u8'\f');
-                    break;
-                case u8'n':
-                    str.push_back(u8'\n');
-                    break;
-                case u8't':
-                    str.push_back(u8'\t');
-                    break;
-                case u8'r':
-                    str.push_back(u8'\r');
-                    break;
-                case u8'u':
+                push(ch);
+                continue;
+            }
+            switch(peek(i++))
+            {
+            case u8'\\':
+                push(u8'\\');
+                break;
+            case u8'\"':
+                push(u8'\"');
+                break;
+            case u8'/':
+                push(u8'/');
+                break;
+            case u8'b':
+                push(u8'\b');
+                break;
+            case u8'f':
+                push(u8'\f');
+                break;
+            case u8'n':
+                push(u8'\n');
+                break;
+            case u8't':
+                push(u8'\t');
+                break;
+            case u8'r':
+                push(u8'\r');
+                break;
+            case u8'u':
+            {
+                int codepoint = json_hex4(json, i);
+                if(codepoint < 0)
+                    return PARSE_INVALID_UNICODE_HEX;
+                i += 4;
+                /*
+                * Json use surrogate pair to represente U+10000~U+10FFFF,
+                * which like \uXXXX\uYYYY
+                * H = XXXX = U+D800 ~ U+DBFF
+                * L = YYYY = U+DC00 ~ U+DFFF
+                * codepoint = 0x10000 + (H − 0xD800) * 0x400 + (L − 0xDC00)
+                */
+                if(codepoint >= 0xD800 && codepoint <= 0xDBFF)
                 {
-                    auto check_codepoint_vaild = [&c](auto i) {
-                        for (auto m = i; m < i + 4; m++)
-                        {
-                            if(m == c.json.end() || 
-                            !((*m >= u8'0' && *m <= u8'9') ||
-                                (*m >= u8'a' && *m <= u8'f') || 
-                                (*m >= u8'A' && *m <= u8'F')))
-                                return false;
-                        }
-                        return true;
-                    };
-                    ++i;
-                    if(!check_codepoint_vaild(i))
+                    if(peek(i) != u8'\\' || peek(i + 1) != u8'u')
+                        return PARSE_INVALID_UNICODE_SURROGATE;
+                    i += 2;
+                    int low_surrogate = json_hex4(json, i);
+                    if(low_surrogate < 0)
                         return PARSE_INVALID_UNICODE_HEX;
-                    unsigned codepoint = std::stoul(std::string(i, i + 4), nullptr, 16);
-                    /*
-                    * Json use surrogate pair to represente U+10000~U+10FFFF,
-                    * which like \uXXXX\uYYYY 
-                    * H = XXXX = U+D800 ~ U+DBFF
-                    * L = YYYY = U+DC00 ~ U+DFFF
-                    * codepoint = 0x10000 + (H − 0xD800) * 0x400 + (L − 0xDC00)
-                    */
-                    if(codepoint >= 0xD800 && codepoint <= 0xDBFF)
-                    {
-                        i += 4; //Next codepoint
-                        if(*i++ != u8'\\')
-                            return PARSE_INVALID_UNICODE_SURROGATE;
-                        if(*i++ != u8'u')
-                            return PARSE_INVALID_UNICODE_SURROGATE;
-
-                        unsigned high_surrogate = codepoint;
-                        if(!check_codepoint_vaild(i))
-                            return PARSE_INVALID_UNICODE_HEX;
-                        unsigned low_surrogate = std::stoul(std::string(i, i + 4), nullptr, 16);
-                        if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
-                            return PARSE_INVALID_UNICODE_SURROGATE;
-
-                        codepoint = 0x10000 + (high_surrogate - 0xD800) * 0x400 + (low_surrogate - 0xDC00);
-                    }
-                    str += json_encode_utf8(codepoint);
-                    i += 3;
-                    break;
-                }
-                default:
-                    return PARSE_INVALID_STRING_ESCAPE;
+                    if(low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
+                        return PARSE_INVALID_UNICODE_SURROGATE;
+                    i += 4;
+                    codepoint = 0x10000 + (codepoint - 0xD800) * 0x400 + (low_surrogate - 0xDC00);
                 }
+                char8_t buffer[4] = {};
+                size_t length = json_encode_utf8(codepoint, buffer);
+                for(size_t k = 0; k < length; k++)
+                    push(buffer[k]);
+                break;
+            }
+            default:
+                return PARSE_INVALID_STRING_ESCAPE;
+            }
+        }
+        return PARSE_INVALID_STRING_END;
+    }
+
+    // Unsigned integer of up to 4096 bits, in little-endian 32-bit words. It
+    // holds the operands of the exact conversions of json_static_number.
+    struct JsonBigInt
+    {
+        uint32_t words[128] = {};
+        size_t size = 0;
+
+        constexpr JsonBigInt(uint32_t n = 0)
+        {
+            words[0] = n;
+            size = n != 0;
+        }
+
+        constexpr size_t bits() const
+        {
+            return size ? 32 * (size - 1) + std::bit_width(words[size - 1]) : 0;
+        }
+
+        constexpr void multiply(uint32_t factor, uint32_t carry = 0)
+        {
+            for(size_t i = 0; i < size; i++)
+            {
+                uint64_t product = uint64_t(words[i]) * factor + carry;
+                words[i] = static_cast<uint32_t>(product);
+                carry = static_cast<uint32_t>(product >> 32);
+            }
+            if(carry)
+                words[size++] = carry;
+        }
+
+        constexpr void multiply_pow10(int n)
+        {
+            constexpr uint32_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+            for(; n > 0; n -= 9)
+                multiply(powers[std::min(n, 9)]);
+        }
+
+        constexpr void shift_left(size_t n)
+        {
+            if(!size)
+                return;
+            size_t step = n / 32, bit = n % 32;
+            size_t grown = size + step + 1;
+            //From the top down, so that every word is read before it is overwritten
+            for(size_t i = grown; i-- > 0;)
+            {
+                uint32_t high = i >= step && i - step < size ? words[i - step] : 0;
+                uint32_t low = bit && i >= step + 1 && i - step - 1 < size ? words[i - step - 1] : 0;
+                words[i] = bit ? (high << bit) | (low >> (32 - bit)) : high;
+            }
+            size = grown;
+            trim();
+        }
+
+        constexpr void shift_right1()
+        {
+            for(size_t i = 0; i < size; i++)
+                words[i] = (words[i] >> 1) | (i + 1 < size ? words[i + 1] << 31 : 0);
+            trim();
+        }
+
+        constexpr int compare(const JsonBigInt &other) const
+        {
+            if(size != other.size)
+                return size < other.size ? -1 : 1;
+            for(size_t i = size; i-- > 0;)
+                if(words[i] != other.words[i])
+                    return words[i] < other.words[i] ? -1 : 1;
+            return 0;
+        }
+
+        //other must not be greater
+        constexpr void subtract(const JsonBigInt &other)
+        {
+            uint32_t borrow = 0;
+            for(size_t i = 0; i < size; i++)
+            {
+                uint64_t term = uint64_t(i < other.size ? other.words[i] : 0) + borrow;
+                borrow = words[i] < term;
+                words[i] = static_cast<uint32_t>(words[i] - term);
+            }
+            trim();
+        }
+
+        constexpr void trim()
+        {
+            while(size && !words[size - 1])
+                size--;
+        }
+    };
+
+    // Rounds q * 2^exponent to the nearest double, ties to even. sticky tells
+    // that the exact value is a little above q * 2^exponent.
+    constexpr double json_round_double(uint64_t q, int exponent, bool sticky)
+    {
+        int zeros = std::countl_zero(q);
+        q <<= zeros;
+        exponent -= zeros;
+        //Now q * 2^exponent is in [2^e, 2^(e+1))
+        int e = exponent + 63;
+        int drop = e >= -1022 ? 11 : -e - 1011;
+        if(drop > 64)
+            return 0.0;
+        uint64_t kept = drop == 64 ? 0 : q >> drop;
+        uint64_t rest = drop == 64 ? q : q & ((uint64_t(1) << drop) - 1);
+        uint64_t half = uint64_t(1) << (drop - 1);
+        if(rest > half || (rest == half && (sticky || (kept & 1))))
+            kept++;
+        //Subnormals, and a subnormal rounded up to the smallest normal
+        if(e < -1022)
+            return std::bit_cast<double>(kept);
+        if(kept >> 53)
+        {
+            kept >>= 1;
+            e++;
+        }
+        if(e > 1023)
+            return std::numeric_limits<double>::infinity();
+        return std::bit_cast<double>((uint64_t(e + 1023) << 52) | (kept & ((uint64_t(1) << 52) - 1)));
+    }
+
+    // Correctly rounded conversion of a validated number token, without its
+    // sign. Digits past the 800th only matter by being zero or not, which
+    // cannot change the rounding.
+    constexpr double json_static_number_exact(std::u8string_view token)
+    {
+        JsonBigInt numerator, denominator(1);
+        size_t i = token.starts_with(u8'-');
+        int exponent = 0, digits = 0;
+        bool dropped = false;
+        for(bool point = false; i < token.length() && token[i] != u8'e' && token[i] != u8'E'; i++)
+        {
+            if(token[i] == u8'.')
+            {
+                point = true;
                 continue;
             }
+            unsigned digit = token[i] - u8'0';
+            if(digits == 0 && digit == 0)
+                exponent -= point;
+            else if(digits < 800)
+            {
+                numerator.multiply(10, digit);
+                digits++;
+                exponent -= point;
+            }
             else
-                str.push_back(*i);
+            {
+                dropped |= digit != 0;
+                exponent += !point;
+            }
         }
-        if(!end_pos)
-            return PARSE_INVALID_STRING_END;
-        return PARSE_OK;
+        if(i < token.length())
+        {
+            bool negative_exponent = token[++i] == u8'-';
+            if(token[i] == u8'-' || token[i] == u8'+')
+                ++i;
+            int e = 0;
+            for(; i < token.length() && e < 100000; i++)
+                e = e * 10 + (token[i] - u8'0');
+            exponent += negative_exponent ? -e : e;
+        }
+        if(dropped)
+        {
+            numerator.multiply(10, 1);
+            digits++;
+            exponent--;
+        }
+
+        //The value is in [10^(digits + exponent - 1), 10^(digits + exponent))
+        if(digits == 0 || digits + exponent < -324)
+            return 0.0;
+        if(digits + exponent > 310)
+            return std::numeric_limits<double>::infinity();
+        (exponent >= 0 ? numerator : denominator).multiply_pow10(exponent < 0 ? -exponent : exponent);
+
+        //Scale so that the quotient has 63 or 64 bits, then divide bit by bit
+        int shift = 63 + int(denominator.bits()) - int(numerator.bits());
+        if(shift >= 0)
+            numerator.shift_left(shift);
+        else
+            denominator.shift_left(-shift);
+        denominator.shift_left(63);
+        uint64_t q = 0;
+        for(int bit = 63; bit >= 0; bit--)
+        {
+            if(numerator.compare(denominator) >= 0)
+            {
+                numerator.subtract(denominator);
+                q |= uint64_t(1) << bit;
+            }
+            denominator.shift_right1();
+        }
+        return json_round_double(q, -shift, numerator.size != 0);
+    }
+
+    // Converts a validated number token, rounded like strtod. Digits that fit
+    // in 2^53 with a power of ten up to 10^22 take one exact floating point
+    // operation, other numbers the exact big integer path.
+    constexpr double json_static_number(std::u8string_view token)
+    {
+        constexpr double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        size_t i = 0;
+        bool negative = token.starts_with(u8'-');
+        if(negative)
+            ++i;
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0;
+        for(bool point = false; i < token.length() && token[i] != u8'e' && token[i] != u8'E'; i++)
+        {
+            if(token[i] == u8'.')
+            {
+                point = true;
+                continue;
+            }
+            //Digits beyond 19 do not fit, only their magnitude is kept
+            if(digits < 19)
+            {
+                mantissa = mantissa * 10 + (token[i] - u8'0');
+                digits += mantissa != 0;
+                exponent -= point;
+            }
+            else
+                exponent += !point;
+        }
+        if(i < token.length())
+        {
+            bool negative_exponent = token[++i] == u8'-';
+            if(token[i] == u8'-' || token[i] == u8'+')
+                ++i;
+            int e = 0;
+            for(; i < token.length() && e < 100000; i++)
+                e = e * 10 + (token[i] - u8'0');
+            exponent += negative_exponent ? -e : e;
+        }
+
+        double value = static_cast<double>(mantissa);
+        if(mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+            value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+        else if(mantissa != 0)
+            value = json_static_number_exact(token);
+        return negative ? -value : value;
+    }
+
+    // Read-only node of a JsonStaticDocument. Strings, keys and raw numbers
+    // are slices of the document's character buffer, children are linked.
+    struct JsonStaticNode
+    {
+        JsonType type = JSON_NULL;
+        double number = 0.0;
+        size_t text = 0;
+        size_t length = 0;
+        size_t key = 0;
+        size_t key_length = 0;
+        size_t size = 0;
+        size_t first = 0;
+        size_t next = 0;
+    };
+
+    // View of a value in a JsonStaticDocument, usable in constant expressions.
+    class JsonStaticValue
+    {
+    public:
+        constexpr JsonStaticValue(const JsonStaticNode *nodes, const char8_t *chars, size_t index)
+            : nodes(nodes), chars(chars), index(index) {}
+
+        constexpr JsonType get_type() const { return node().type; }
+        constexpr double get_number() const
+        {
+            assert(get_type() == JSON_NUMBER);
+            return node().number;
+        }
+        constexpr std::u8string_view get_number_text() const
+        {
+            assert(get_type() == JSON_NUMBER);
+            return std::u8string_view(chars + node().text, node().length);
+        }
+        constexpr std::u8string_view get_string() const
+        {
+            assert(get_type() == JSON_STRING);
+            return std::u8string_view(chars + node().text, node().length);
+        }
+        //Key of an object member
+        constexpr std::u8string_view get_key() const
+        {
+            return std::u8string_view(chars + node().key, node().key_length);
+        }
+        constexpr size_t size() const { return node().size; }
+
+        //Element of an array, or member of an object in document order
+        constexpr JsonStaticValue operator[](size_t i) const
+        {
+            assert(i < size());
+            size_t child = node().first;
+            while(i--)
+                child = nodes[child].next;
+            return JsonStaticValue(nodes, chars, child);
+        }
+        constexpr bool contains(std::u8string_view key) const
+        {
+            return find(key) != 0;
+        }
+        constexpr JsonStaticValue operator[](std::u8string_view key) const
+        {
+            assert(contains(key));
+            return JsonStaticValue(nodes, chars, find(key));
+        }
+
+        JsonValue to_value() const;
+
+    private:
+        constexpr const JsonStaticNode &node() const { return nodes[index]; }
+        constexpr size_t find(std::u8string_view key) const
+        {
+            assert(get_type() == JSON_OBJECT);
+            for(size_t child = node().first; child; child = nodes[child].next)
+                if(JsonStaticValue(nodes, chars, child).get_key() == key)
+                    return child;
+            return 0;
+        }
+
+        const JsonStaticNode *nodes;
+        const char8_t *chars;
+        size_t index;
+    };
+
+    // Constexpr parser of JsonStaticDocument. Without storage it only counts
+    // the nodes and characters a document needs.
+    struct JsonStaticParser
+    {
+        JsonStaticNode *nodes = nullptr;
+        char8_t *chars = nullptr;
+        //Room in the storage, unbounded while counting
+        size_t node_capacity = SIZE_MAX;
+        size_t char_capacity = SIZE_MAX;
+        size_t node_count = 0;
+        size_t char_count = 0;
+        //Target of the writes while counting
+        JsonStaticNode scratch;
+
+        constexpr int parse(std::u8string_view json)
+        {
+            node_count = char_count = 0;
+            size_t pos = skip_whitespace(json, 0), root = 0;
+            int ret = parse_value(json, pos, root);
+            if(ret == PARSE_OK && skip_whitespace(json, pos) != json.length())
+                ret = PARSE_ROOT_NOT_SINGULAR;
+            //Characters past the capacity are counted but not stored
+            if(ret == PARSE_OK && char_count > char_capacity)
+                ret = PARSE_LIMIT_EXCEEDED;
+            return ret;
+        }
+
+        constexpr JsonStaticNode &at(size_t index) { return nodes ? nodes[index] : scratch; }
+        constexpr void put(char8_t ch)
+        {
+            if(chars && char_count < char_capacity)
+                chars[char_count] = ch;
+            ++char_count;
+        }
+
+        static constexpr size_t skip_whitespace(std::u8string_view json, size_t pos)
+        {
+            while(pos < json.length() && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r'))
+                pos++;
+            return pos;
+        }
+
+        constexpr int parse_value(std::u8string_view json, size_t &pos, size_t &index)
+        {
+            if(pos == json.length())
+                return PARSE_EXPECT_VALUE;
+            if(node_count == node_capacity)
+                return PARSE_LIMIT_EXCEEDED;
+            index = node_count++;
+            JsonStaticNode &node = at(index);
+            std::u8string_view rest = json.substr(pos);
+            switch(json[pos])
+            {
+            case u8'n':
+            case u8'f':
+            case u8't':
+            {
+                std::u8string_view literal = json[pos] == u8'n' ? u8"null" : json[pos] == u8'f' ? u8"false" : u8"true";
+                if(!rest.starts_with(literal))
+                    return PARSE_INVALID_VALUE;
+                node.type = json[pos] == u8'n' ? JSON_NULL : json[pos] == u8'f' ? JSON_FALSE : JSON_TRUE;
+                pos += literal.length();
+                return PARSE_OK;
+            }
+            case u8'\"':
+            {
+                node.type = JSON_STRING;
+                return parse_string(json, pos, node.text, node.length);
+            }
+            case u8'[':
+            case u8'{':
+                return parse_container(json, pos, index);
+            default:
+            {
+                //Raw numbers keep their text as well
+                size_t length = json_scan_number(rest);
+                if(!length)
+                    return PARSE_INVALID_VALUE;
+                node.type = JSON_NUMBER;
+                node.number = json_static_number(rest.substr(0, length));
+                if(node.number == std::numeric_limits<double>::infinity() || node.number == -std::numeric_limits<double>::infinity())
+                    return PARSE_NUMBER_TOO_BIG;
+                node.text = char_count;
+                node.length = length;
+                for(size_t i = 0; i < length; i++)
+                    put(rest[i]);
+                pos += length;
+                return PARSE_OK;
+            }
+            }
+        }
+
+        constexpr int parse_string(std::u8string_view json, size_t &pos, size_t &text, size_t &length)
+        {
+            size_t end_pos = 0;
+            text = char_count;
+            int ret = json_decode_string(json.substr(pos), end_pos, [this](char8_t ch) { put(ch); });
+            length = char_count - text;
+            pos += end_pos;
+            return ret;
+        }
+
+        constexpr int parse_container(std::u8string_view json, size_t &pos, size_t index)
+        {
+            bool array = json[pos++] == u8'[';
+            at(index).type = array ? JSON_ARRAY : JSON_OBJECT;
+            size_t last = 0;
+            pos = skip_whitespace(json, pos);
+            if(pos < json.length() && json[pos] == (array ? u8']' : u8'}'))
+            {
+                ++pos;
+                return PARSE_OK;
+            }
+            while(true)
+            {
+                size_t key = 0, key_length = 0, child = 0;
+                if(!array)
+                {
+                    if(pos == json.length())
+                        return PARSE_INVAID_OBJECT_END;
+                    if(json[pos] != u8'\"' || parse_string(json, pos, key, key_length) != PARSE_OK)
+                        return PARSE_INVALID_OBJECT_KEY;
+                    pos = skip_whitespace(json, pos);
+                    if(pos == json.length() || json[pos] != u8':')
+                        return PARSE_INVALID_OBJECT_SEPARATOR;
+                    pos = skip_whitespace(json, pos + 1);
+                }
+                else if(pos == json.length())
+                    return PARSE_INVAID_ARRAY_END;
+
+                int ret = parse_value(json, pos, child);
+                if(ret != PARSE_OK)
+                    return array || ret == PARSE_LIMIT_EXCEEDED || ret == PARSE_NUMBER_TOO_BIG ? ret : PARSE_INVALID_OBJECT_VALUE;
+                at(child).key = key;
+                at(child).key_length = key_length;
+                if(last)
+                    at(last).next = child;
+                else
+                    at(index).first = child;
+                last = child;
+                ++at(index).size;
+
+                pos = skip_whitespace(json, pos);
+                if(pos < json.length() && json[pos] == (array ? u8']' : u8'}'))
+                {
+                    ++pos;
+                    return PARSE_OK;
+                }
+                if(pos == json.length() || json[pos] != u8',')
+                    return array ? PARSE_INVAID_ARRAY_END : PARSE_INVAID_OBJECT_END;
+                pos = skip_whitespace(json, pos + 1);
+                if(pos < json.length() && json[pos] == (array ? u8']' : u8'}'))
+                    return array ? PARSE_EXTRA_ARRAY_SEPARATOR : PARSE_EXTRA_OBJECT_SEPARATOR;
+            }
+        }
+
+    };
+
+    // Read-only DOM with room for Nodes nodes and Chars characters of strings,
+    // keys and numbers. parse() returns PARSE_LIMIT_EXCEEDED for a document
+    // that needs more; u8"..."_json counts them first to size it exactly.
+    template<size_t Nodes, size_t Chars>
+    class JsonStaticDocument
+    {
+    public:
+        constexpr int parse(std::u8string_view json)
+        {
+            JsonStaticParser parser{nodes, chars, Nodes, Chars};
+            return parser.parse(json);
+        }
+        constexpr JsonStaticValue root() const { return JsonStaticValue(nodes, chars, 0); }
+
+    private:
+        JsonStaticNode nodes[Nodes] = {};
+        char8_t chars[Chars] = {};
+    };
+
+    // String literal usable as a template argument.
+    template<size_t N>
+    struct JsonLiteral
+    {
+        static constexpr size_t size = N;
+        char8_t text[N] = {};
+        constexpr JsonLiteral(const char8_t (&s)[N]) { std::copy_n(s, N, text); }
+    };
+
+    // Not constexpr: calling it makes a malformed literal a compile error.
+    void json_static_parse_failed(int);
+
+    // Nodes and characters needed by a literal, counted without storage
+    consteval JsonStaticParser json_static_count(std::u8string_view json)
+    {
+        JsonStaticParser parser;
+        parser.parse(json);
+        return parser;
+    }
+
+    template<JsonLiteral S>
+    consteval auto json_static_parse()
+    {
+        constexpr std::u8string_view json(S.text, S.size - 1);
+        constexpr JsonStaticParser count = json_static_count(json);
+        JsonStaticDocument<std::max<size_t>(count.node_count, 1), std::max<size_t>(count.char_count, 1)> document;
+        if(int ret = document.parse(json); ret != PARSE_OK)
+            json_static_parse_failed(ret);
+        return document;
+    }
+
+    inline namespace literals
+    {
+        // u8"..."_json parses the literal at compile time.
+        template<JsonLiteral S>
+        consteval auto operator""_json()
+        {
+            return json_static_parse<S>();
+        }
+    }
+
+    // RFC 7396 Merge Patch, applied in place. The members of patch are moved
+    // into target, pass it with std::move() to avoid copying it.
+    void json_merge_patch(JsonValue &target, JsonValue patch);
+
+    enum JsonPatchOp
+    {
+        JSON_PATCH_ADD,
+        JSON_PATCH_REMOVE,
+        JSON_PATCH_REPLACE,
+        JSON_PATCH_MOVE,
+        JSON_PATCH_COPY,
+        JSON_PATCH_TEST,
+    };
+
+    // An applied step, kept to roll a failed patch back
+    struct JsonPatchUndo
+    {
+        JsonPatchOp op;
+        std::u8string path;
+        JsonValue value;
+        //The value is the one taken out by the step undone before this one
+        bool carried = false;
+    };
+
+    // RFC 6902 JSON Patch, applied in place. "move" moves the value and the
+    // "value" members are moved out of patch. If an operation fails, the ones
+    // before it are undone and target is left unchanged.
+    int json_patch(JsonValue &target, JsonValue patch);
+    // Steps of json_patch(). The value is only moved from when they succeed.
+    int json_patch_add(JsonValue &, std::u8string_view, JsonValue &, std::vector<JsonPatchUndo> &);
+    int json_patch_remove(JsonValue &, std::u8string_view, JsonValue &, std::vector<JsonPatchUndo> &);
+    int json_patch_replace(JsonValue &, std::u8string_view, JsonValue &, std::vector<JsonPatchUndo> &);
+    JsonValue *json_patch_parent(JsonValue &, std::u8string_view, std::u8string &);
+    JsonValue json_patch_operation(const char8_t *, const std::u8string &, const JsonValue *);
+
+    // JSON Patch turning from into to. Common prefixes and suffixes of arrays
+    // are skipped, so an insertion or removal gives a single operation.
+    JsonValue json_diff(JsonValue &from, JsonValue &to);
+    void json_diff(JsonValue &from, JsonValue &to, std::u8string &path, std::vector<JsonValue> &patch);
+
+    struct JsonFormat
+    {
+        //Spaces per level, 0 writes minified output
+        int indent = 0;
+        //Escape non-ASCII characters as \uXXXX, like to_string()
+        bool ascii = true;
+    };
+
+    // DOM-free reformatter on top of json_events(). Its memory depends on the
+    // nesting depth and the longest token only, never on the document size.
+    class JsonTranscoder
+    {
+    public:
+        explicit JsonTranscoder(const JsonFormat &format = JsonFormat());
+        //The event generator refers to this object's input
+        JsonTranscoder(const JsonTranscoder &) = delete;
+        JsonTranscoder(JsonTranscoder &&) = delete;
+        JsonTranscoder &operator=(const JsonTranscoder &) = delete;
+        JsonTranscoder &operator=(JsonTranscoder &&) = delete;
+        //Appends the output for the chunk to out, the chunk is fully consumed
+        int feed(std::u8string_view chunk, std::u8string &out);
+        //Marks the end of input
+        int finish(std::u8string &out);
+
+    private:
+        int run(std::u8string &out);
+        void write(const JsonEvent &, std::u8string &out);
+        void newline(std::u8string &out);
+
+        JsonFormat format;
+        JsonInput in;
+        JsonGenerator<JsonEvent> events;
+        //For each open container, whether it is still empty
+        std::vector<bool> empty;
+        bool after_key = false;
+        int ret = PARSE_OK;
+    };
+
+    int json_transcode(std::u8string_view, std::u8string &, const JsonFormat & = JsonFormat());
+
+    // Parses one document from read(char8_t *buffer, size_t size), which
+    // returns the number of bytes read and 0 at the end of input.
+    template<typename Read>
+    int json_parse_reader(JsonValue &v, Read read, const JsonParseOptions &options, size_t window)
+    {
+        std::vector<char8_t> buffer(window);
+        JsonInput in;
+        in.max_token = json_max_token(options);
+        JsonValueBuilder builder(v, options);
+        int ret = PARSE_OK;
+        for(auto &e: json_events(in))
+        {
+            if(e.type == JSON_EVENT_NEED_MORE)
+            {
+                size_t size = read(buffer.data(), buffer.size());
+                if(size == 0)
+                    in.close();
+                else
+                    in.feed(std::u8string_view(buffer.data(), size));
+            }
+            else if(e.type == JSON_EVENT_ERROR)
+                ret = e.error;
+            else
+                builder.add(e);
+            //Stop reading once a limit is broken
+            if(builder.error() != PARSE_OK)
+            {
+                ret = builder.error();
+                break;
+            }
+        }
+        //The document is only complete at the end, so the schema is checked then
+        if(ret == PARSE_OK && options.schema)
+            ret = json_validate(*options.schema, v, options.schema_error);
+        if(ret != PARSE_OK)
+            v = JSON_NULL;
+        return ret;
+    }
+
+    // Parses one document from an asynchronous byte source, reading it through
+    // a fixed buffer. source.read(char8_t *buffer, size_t size) must return an
+    // awaitable giving the number of bytes read, 0 at the end of input. The
+    // options are copied, since the task can outlive the caller's arguments.
+    template<typename Source>
+    JsonTask<int> json_parse_async(Source &source, JsonValue &v, JsonParseOptions options = JsonParseOptions())
+    {
+        char8_t buffer[4096];
+        JsonInput in;
+        in.max_token = json_max_token(options);
+        JsonValueBuilder builder(v, options);
+        int ret = PARSE_OK;
+        for(auto &e: json_events(in))
+        {
+            if(e.type == JSON_EVENT_NEED_MORE)
+            {
+                size_t size = co_await source.read(buffer, sizeof(buffer));
+                if(size == 0)
+                    in.close();
+                else
+                    in.feed(std::u8string_view(buffer, size));
+            }
+            else if(e.type == JSON_EVENT_ERROR)
+                ret = e.error;
+            else
+                builder.add(e);
+            if(builder.error() != PARSE_OK)
+            {
+                ret = builder.error();
+                break;
+            }
+        }
+        if(ret == PARSE_OK && options.schema)
+            ret = json_validate(*options.schema, v, options.schema_error);
+        if(ret != PARSE_OK)
+            v = JSON_NULL;
+        co_return ret;
+    }
+
+    int json_parse(JsonValue &v, std::u8string_view json, const JsonParseOptions &options)
+    {
+        JsonContext c;
+        return json_parse(c, v, json, options);
+    }
+
+    int json_parse(JsonValue &v, const char *json, const JsonParseOptions &options)
+    {
+        return json_parse(v, json_as_u8(json, strlen(json)), options);
+    }
+
+    int json_parse(JsonValue &v, std::istream &stream, const JsonParseOptions &options, size_t window)
+    {
+        return json_parse_reader(v, [&stream](char8_t *buffer, size_t size) {
+            stream.read(reinterpret_cast<char *>(buffer), size);
+            return size_t(stream.gcount());
+        }, options, window);
+    }
+
+    int json_parse(JsonValue &v, FILE *file, const JsonParseOptions &options, size_t window)
+    {
+        return json_parse_reader(v, [file](char8_t *buffer, size_t size) {
+            return fread(buffer, 1, size, file);
+        }, options, window);
+    }
+
+    int json_parse(JsonContext &c, JsonValue &v, std::u8string_view json, const JsonParseOptions &options)
+    {
+        c.json = json;
+        c.source = json;
+        c.schema = options.schema;
+        c.schema_error = options.schema_error;
+        c.raw_numbers = options.raw_numbers;
+        c.path.clear();
+        c.max_bytes = options.max_bytes;
+        c.max_values = options.max_values;
+        c.max_length = options.max_length;
+        c.memory_budget = options.memory_budget;
+        c.limited = options.limited();
+        c.bytes = 0;
+        c.values = 0;
+
+        json_parse_whitespace(c);
+        int ret;
+        if((ret = json_parse_value(c, v)) == PARSE_OK)
+        {
+            json_parse_whitespace(c);
+            if(!c.json.empty())
+                ret = PARSE_ROOT_NOT_SINGULAR;
+        }
+        if(ret != PARSE_OK)
+            v = JSON_NULL;
+        return ret;
+    }
+
+    int JsonParser::parse(std::u8string_view json, JsonValue &v, const JsonParseOptions &options)
+    {
+        return json_parse(context, v, json, options);
+    }
+
+    void JsonParser::shrink()
+    {
+        context = JsonContext();
+    }
+
+    void json_parse_whitespace(JsonContext &context)
+    {
+        size_t i = 0;
+        const std::u8string_view &json = context.json;
+        while(i < json.size() && (json[i] == ' ' || json[i] ==  '\t' || json[i] == '\n' || json[i] == '\r'))
+            i++;
+        context.json = json.substr(i);
+    }
+
+    int json_parse_value(JsonContext& context, JsonValue &value)
+    {
+        if(context.json.empty())
+            return PARSE_EXPECT_VALUE;
+        if(context.limited && ++context.values > context.max_values)
+            return PARSE_LIMIT_EXCEEDED;
+        //Reject a value of the wrong type before it is materialized
+        const JsonSchema *schema = context.schema;
+        const char8_t *start = context.json.data();
+        if(schema && !json_schema_check_start(*schema, *context.json.begin()))
+            return json_schema_violation(context, start);
+
+        int ret;
+        switch(*context.json.begin())
+        {
+            case u8'n':
+                ret = json_parse_literal(context, value, u8"null", JSON_NULL);
+                break;
+            case u8'f':
+                ret = json_parse_literal(context, value, u8"false", JSON_FALSE);
+                break;
+            case u8't':
+                ret = json_parse_literal(context, value, u8"true", JSON_TRUE);
+                break;
+            case u8'\"':
+                ret = json_parse_string(context, value);
+                break;
+            case u8'[':
+                ret = json_parse_array(context, value);
+                break;
+            case u8'{':
+                ret = json_parse_object(context, value);
+                break;
+            case u8'\0':
+                return PARSE_EXPECT_VALUE;
+            default:
+                ret = json_parse_number(context, value);
+                break;
+        }
+
+        if(ret == PARSE_OK && schema && !json_schema_check(*schema, value))
+            return json_schema_violation(context, start);
+        return ret;
+    }
+
+    int json_parse_literal(JsonContext &c, JsonValue &v, const std::u8string_view literal, JsonType type)
+    {
+        if(!c.json.starts_with(literal))
+            return PARSE_INVALID_VALUE;
+        v.reset(type);
+        c.json = c.json.substr(literal.length());
+        return PARSE_OK;
+    }
+
+    int json_parse_number(JsonContext &c, JsonValue &v)
+    {
+        size_t number_length = json_scan_number(c.json);
+        if(!number_length)
+            return PARSE_INVALID_VALUE;
+        v.reset(JSON_NUMBER);
+        if(c.limited && c.raw_numbers && !json_reserve_string(c, v.text, number_length))
+            return PARSE_LIMIT_EXCEEDED;
+        if(c.raw_numbers)
+            v.set_raw_number(c.json.substr(0, number_length));
+        else
+        {
+            double number = json_decode_number(c.json.substr(0, number_length));
+            if(std::isinf(number))
+                return PARSE_NUMBER_TOO_BIG;
+            v.set_number(number);
+        }
+        c.json = c.json.substr(number_length);
+        return PARSE_OK;
+    }
+
+    int json_parse_string_raw(JsonContext &c, std::u8string &str, size_t& end_pos, bool charged)
+    {
+        if(!c.limited)
+            return json_decode_string(c.json, end_pos, [&str](char8_t ch) { str.push_back(ch); });
+        //Past a limit the rest of the string is only scanned
+        bool exceeded = false;
+        int ret = json_decode_string(c.json, end_pos, [&](char8_t ch) {
+            if(!exceeded && (str.size() == c.max_length || (charged && !json_reserve_string(c, str, str.size() + 1))))
+                exceeded = true;
+            if(!exceeded)
+                str.push_back(ch);
+        });
+        return ret == PARSE_OK && exceeded ? PARSE_LIMIT_EXCEEDED : ret;
+    }
+
+    bool json_charge(JsonContext &c, size_t bytes)
+    {
+        if(!bytes)
+            return true;
+        if(bytes > c.max_bytes - c.bytes || (c.memory_budget && !c.memory_budget->charge(bytes)))
+            return false;
+        c.bytes += bytes;
+        return true;
+    }
+
+    // Grows str to hold size bytes, doubling its capacity, and charges the
+    // difference first. A library may round the capacity up further; the
+    // capacity it really picked is then charged too, after the allocation,
+    // so that the charged bytes still agree with memory_usage().
+    bool json_reserve_string(JsonContext &c, std::u8string &str, size_t size)
+    {
+        size_t capacity = str.capacity();
+        if(size <= capacity)
+            return true;
+        size_t grown = std::max(size, 2 * capacity);
+        if(!json_charge(c, json_string_heap(grown) - json_string_heap(capacity)))
+            return false;
+        str.reserve(grown);
+        return json_charge(c, json_string_heap(str.capacity()) - json_string_heap(grown));
+    }
+
+    // Makes room for one more element of array, doubling its capacity. Fails
+    // at the length limit, or when the growth cannot be charged.
+    bool json_reserve_array(JsonContext &c, std::vector<JsonValue> &array)
+    {
+        size_t size = array.size(), capacity = array.capacity();
+        if(size == c.max_length)
+            return false;
+        if(size < capacity)
+            return true;
+        size_t grown = std::max<size_t>(1, 2 * capacity);
+        if(!json_charge(c, (grown - capacity) * sizeof(JsonValue)))
+            return false;
+        array.reserve(grown);
+        return true;
+    }
+
+    size_t json_max_token(const JsonParseOptions &options)
+    {
+        size_t limit = std::min(options.max_bytes, options.max_length);
+        return limit > (SIZE_MAX - 2) / 6 ? SIZE_MAX : 6 * limit + 2;
+    }
+
+    size_t json_string_heap(size_t capacity)
+    {
+        //Short strings are stored inline
+        static const size_t inline_capacity = std::u8string().capacity();
+        return capacity > inline_capacity ? capacity + 1 : 0;
+    }
+
+    int json_parse_string(JsonContext &c, JsonValue &v)
+    {
+        int ret = PARSE_OK;
+        size_t end_quotation_pos = 0;
+        v.reset(JSON_STRING);
+        //Decode straight into the value, reusing its capacity
+        std::u8string &str = v.get_string();
+        str.clear();
+        if((ret = json_parse_string_raw(c, str, end_quotation_pos, true)) != PARSE_OK)
+            return ret;
+        c.json = c.json.substr(end_quotation_pos);
+        return PARSE_OK;
+    }
+
+    double json_decode_number(std::u8string_view number)
+    {
+        //Short numbers are converted from a stack buffer to avoid allocation
+        char buffer[64];
+        if(number.length() < sizeof(buffer))
+        {
+            std::copy(number.begin(), number.end(), buffer);
+            buffer[number.length()] = '\0';
+            return std::strtod(buffer, nullptr);
+        }
+        return std::strtod(std::string(number.begin(), number.end()).c_str(), nullptr);
+    }
+
+    // The token of a raw integer with -0 written as 0, empty for other numbers
+    std::u8string_view json_integer_token(std::u8string_view token)
+    {
+        std::u8string_view digits = token.starts_with(u8'-') ? token.substr(1) : token;
+        if(digits.empty() || !std::all_of(digits.begin(), digits.end(), [](char8_t ch) { return ch >= u8'0' && ch <= u8'9'; }))
+            return std::u8string_view();
+        return digits == u8"0" ? digits : token;
+    }
+
+    bool json_number_equal(double a, std::u8string_view a_text, double b, std::u8string_view b_text)
+    {
+        //JSON integers have no leading zeros, so equal values have equal tokens
+        std::u8string_view x = json_integer_token(a_text), y = json_integer_token(b_text);
+        if(!x.empty() && !y.empty())
+            return x == y;
+        //Equal values round to the same double, which rejects most pairs
+        if(a != b)
+            return false;
+        if(x.empty() && y.empty())
+            return true;
+        //Otherwise the integer must be the exact value of the other double
+        double n = x.empty() ? a : b;
+        if(n != std::trunc(n))
+            return false;
+        char buffer[320];
+        auto end = std::to_chars(buffer, buffer + sizeof(buffer), n + 0.0, std::chars_format::fixed, 0).ptr;
+        return (x.empty() ? y : x) == std::u8string_view(reinterpret_cast<const char8_t *>(buffer), end - buffer);
+    }
+
+    std::u8string json_encode_utf8(unsigned codepoint)
+    {
+        char8_t buffer[4];
+        return std::u8string(buffer, json_encode_utf8(codepoint, buffer));
+    }
+
+    int json_parse_array(JsonContext &c, JsonValue &v)
+    {
+        c.json = c.json.substr(1);
+        //Parse into the existing elements, so that their storage is reused
+        v.reset(JSON_ARRAY);
+        std::vector<JsonValue> &result = v.get_array();
+        const JsonSchema *schema = c.schema;
+        size_t count = 0;
+        int ret = PARSE_OK;
+        json_parse_whitespace(c);
+        while(!c.json.starts_with(u8"]"))
+        {
+            if(c.json.length() == 0)
+                return PARSE_INVAID_ARRAY_END;
+            if(count == result.size())
+            {
+                if(c.limited && !json_reserve_array(c, result))
+                    return PARSE_LIMIT_EXCEEDED;
+                result.emplace_back();
+            }
+            c.schema = schema ? schema->items.get() : nullptr;
+            if(!c.schema)
+                ret = json_parse_value(c, result[count]);
+            else
+            {
+                //Only values with a schema can fail, so only they extend the path
+                size_t path_length = c.path.length();
+                char index[24];
+                c.path += u8"/";
+                c.path.append(index, std::to_chars(index, index + sizeof(index), count).ptr);
+                if((ret = json_parse_value(c, result[count])) == PARSE_OK)
+                    c.path.resize(path_length);
+            }
+            if(ret != PARSE_OK)
+                return ret;
+            ++count;
+            json_parse_whitespace(c);
+
+            //handle ','
+            if(c.json.starts_with(u8","))
+            {
+                c.json = c.json.substr(1);
+                json_parse_whitespace(c);
+                if(c.json.starts_with(u8"]"))
+                    return PARSE_EXTRA_ARRAY_SEPARATOR;
+            }
+            //Elements need a separator between them
+            else if(!c.json.empty() && !c.json.starts_with(u8"]"))
+                return PARSE_INVAID_ARRAY_END;
+        }
+        //handle ']'
+        c.json = c.json.substr(1);
+        c.schema = schema;
+        result.erase(result.begin() + count, result.end());
+        return ret;
+    }
+
+    int json_member_error(int ret)
+    {
+        if(ret == PARSE_SCHEMA_VIOLATION || ret == PARSE_LIMIT_EXCEEDED || ret == PARSE_NUMBER_TOO_BIG)
+            return ret;
+        return PARSE_INVALID_OBJECT_VALUE;
+    }
+
+    int json_parse_object(JsonContext &c, JsonValue &v)
+    {
+        //handle '{'
+        c.json = c.json.substr(1);
+        v.reset(JSON_OBJECT);
+        std::map<std::u8string, JsonValue> &result = v.get_object();
+        //Members of the previous object are recycled, matching keys first
+        std::map<std::u8string, JsonValue> previous;
+        previous.swap(result);
+        const JsonSchema *schema = c.schema;
+        int ret = PARSE_OK;
+        json_parse_whitespace(c);
+        while(ret == PARSE_OK && !c.json.starts_with(u8"}"))
+        {
+            if(c.json.empty())
+                return PARSE_INVAID_OBJECT_END;
+
+            if(!c.json.starts_with(u8"\""))
+                return PARSE_INVALID_OBJECT_KEY;
+            size_t key_end_pos = 0;
+            const char8_t *key_start = c.json.data();
+            c.key.clear();
+            //The scratch key is charged as it grows, like a string value
+            if((ret = json_parse_string_raw(c, c.key, key_end_pos, true)) != PARSE_OK)
+                return ret == PARSE_LIMIT_EXCEEDED ? ret : PARSE_INVALID_OBJECT_KEY;
+            c.json = c.json.substr(key_end_pos);
+
+            c.schema = nullptr;
+            size_t path_length = c.path.length();
+            if(schema)
+            {
+                auto property = schema->properties.find(c.key);
+                if(property != schema->properties.end())
+                    c.schema = &property->second;
+                else
+                    c.schema = schema->additional.get();
+                if(c.schema || !schema->additional_allowed)
+                    json_append_pointer(c.path, c.key);
+                if(property == schema->properties.end() && !schema->additional_allowed)
+                    return json_schema_violation(c, key_start);
+            }
+
+            json_parse_whitespace(c);
+            if(!c.json.starts_with(u8":"))
+                return PARSE_INVALID_OBJECT_SEPARATOR;
+            //handle ':'
+            c.json = c.json.substr(1);
+            json_parse_whitespace(c);
+
+            //Under limits only the member with the same key is reused, the
+            //others hold storage that was never charged to this parse
+            auto node = previous.extract(c.key);
+            if(node.empty() && !c.limited && !c.nodes.empty())
+            {
+                node = std::move(c.nodes.back());
+                c.nodes.pop_back();
+            }
+            else if(node.empty() && !c.limited && !previous.empty())
+                node = previous.extract(previous.begin());
+
+            if(c.limited && result.size() == c.max_length && !result.contains(c.key))
+                return PARSE_LIMIT_EXCEEDED;
+            if(node.empty())
+            {
+                //Nothing to recycle, the first occurrence of a key wins
+                if(c.limited && !result.contains(c.key) &&
+                   !json_charge(c, JSON_MEMBER_BYTES + json_string_heap(c.key.size())))
+                    return PARSE_LIMIT_EXCEEDED;
+                auto [member, inserted] = result.try_emplace(c.key);
+                JsonValue duplicate;
+                if((ret = json_parse_value(c, inserted ? member->second : duplicate)) != PARSE_OK)
+                    return json_member_error(ret);
+            }
+            else
+            {
+                if(c.limited && !json_reserve_string(c, node.key(), c.key.size()))
+                    return PARSE_LIMIT_EXCEEDED;
+                node.key() = c.key;
+                if((ret = json_parse_value(c, node.mapped())) != PARSE_OK)
+                    return json_member_error(ret);
+                auto inserted = result.insert(std::move(node));
+                if(!inserted.inserted)
+                    c.nodes.push_back(std::move(inserted.node));
+            }
+
+            c.path.resize(path_length);
+
+            json_parse_whitespace(c);
+            //handle ','
+            if(c.json.starts_with(u8","))
+            {
+                c.json = c.json.substr(1);
+                json_parse_whitespace(c);
+                if(c.json.starts_with(u8"}"))
+                    return PARSE_EXTRA_OBJECT_SEPARATOR;
+            }
+            else if(!c.json.empty() && !c.json.starts_with(u8"}"))
+                return PARSE_INVAID_OBJECT_END;
+        }
+        //handle '}'
+        c.json = c.json.substr(1);
+        c.schema = schema;
+        while(!previous.empty())
+            c.nodes.push_back(previous.extract(previous.begin()));
+        return ret;
+    }
+
+    int json_compile_schema(JsonSchema &s, JsonValue &schema)
+    {
+        s = JsonSchema();
+        //Boolean schemas accept everything or nothing
+        if(schema.get_type() == JSON_TRUE)
+            return PARSE_OK;
+        if(schema.get_type() == JSON_FALSE)
+        {
+            s.types = 0;
+            return PARSE_OK;
+        }
+        if(schema.get_type() != JSON_OBJECT)
+            return PARSE_INVALID_SCHEMA;
+
+        auto &object = schema.get_object();
+        auto find = [&object](const char8_t *key) -> JsonValue * {
+            auto i = object.find(key);
+            if(i == object.end())
+                return nullptr;
+            return &i->second;
+        };
+        auto type_bits = [](JsonValue &name) -> unsigned {
+            static const std::map<std::u8string, unsigned> names{
+                {u8"null", 1u << JSON_NULL},
+                {u8"boolean", 1u << JSON_FALSE | 1u << JSON_TRUE},
+                {u8"number", 1u << JSON_NUMBER},
+                {u8"integer", JSON_SCHEMA_INTEGER},
+                {u8"string", 1u << JSON_STRING},
+                {u8"array", 1u << JSON_ARRAY},
+                {u8"object", 1u << JSON_OBJECT}};
+            if(name.get_type() != JSON_STRING)
+                return 0;
+            auto i = names.find(name.get_string());
+            return i == names.end() ? 0 : i->second;
+        };
+
+        if(JsonValue *type = find(u8"type"))
+        {
+            s.types = 0;
+            if(type->get_type() == JSON_ARRAY)
+            {
+                for(auto &i: type->get_array())
+                    if(unsigned bits = type_bits(i))
+                        s.types |= bits;
+                    else
+                        return PARSE_INVALID_SCHEMA;
+            }
+            else if(!(s.types = type_bits(*type)))
+                return PARSE_INVALID_SCHEMA;
+        }
+
+        if(JsonValue *required = find(u8"required"))
+        {
+            if(required->get_type() != JSON_ARRAY)
+                return PARSE_INVALID_SCHEMA;
+            for(auto &i: required->get_array())
+            {
+                if(i.get_type() != JSON_STRING)
+                    return PARSE_INVALID_SCHEMA;
+                s.required.push_back(i.get_string());
+            }
+        }
+
+        if(JsonValue *properties = find(u8"properties"))
+        {
+            if(properties->get_type() != JSON_OBJECT)
+                return PARSE_INVALID_SCHEMA;
+            for(auto &i: properties->get_object())
+                if(json_compile_schema(s.properties[i.first], i.second) != PARSE_OK)
+                    return PARSE_INVALID_SCHEMA;
+        }
+
+        if(JsonValue *items = find(u8"items"))
+        {
+            auto compiled = std::make_shared<JsonSchema>();
+            if(json_compile_schema(*compiled, *items) != PARSE_OK)
+                return PARSE_INVALID_SCHEMA;
+            s.items = compiled;
+        }
+
+        if(JsonValue *additional = find(u8"additionalProperties"))
+        {
+            if(additional->get_type() == JSON_FALSE)
+                s.additional_allowed = false;
+            else if(additional->get_type() != JSON_TRUE)
+            {
+                auto compiled = std::make_shared<JsonSchema>();
+                if(json_compile_schema(*compiled, *additional) != PARSE_OK)
+                    return PARSE_INVALID_SCHEMA;
+                s.additional = compiled;
+            }
+        }
+
+        if(JsonValue *enumeration = find(u8"enum"))
+        {
+            if(enumeration->get_type() != JSON_ARRAY)
+                return PARSE_INVALID_SCHEMA;
+            s.enumeration = enumeration->get_array();
+        }
+
+        if(JsonValue *minimum = find(u8"minimum"))
+        {
+            if(minimum->get_type() != JSON_NUMBER)
+                return PARSE_INVALID_SCHEMA;
+            s.has_minimum = true;
+            s.minimum = minimum->get_number();
+        }
+
+        if(JsonValue *maximum = find(u8"maximum"))
+        {
+            if(maximum->get_type() != JSON_NUMBER)
+                return PARSE_INVALID_SCHEMA;
+            s.has_maximum = true;
+            s.maximum = maximum->get_number();
+        }
+
+        if(JsonValue *max_length = find(u8"maxLength"))
+        {
+            if(max_length->get_type() != JSON_NUMBER || max_length->get_number() < 0)
+                return PARSE_INVALID_SCHEMA;
+            s.max_length = static_cast<size_t>(max_length->get_number());
+        }
+        return PARSE_OK;
+    }
+
+    bool json_schema_check_start(const JsonSchema &s, char8_t ch)
+    {
+        unsigned bits;
+        switch(ch)
+        {
+        case u8'\"':
+            bits = 1u << JSON_STRING;
+            break;
+        case u8'[':
+            bits = 1u << JSON_ARRAY;
+            break;
+        case u8'{':
+            bits = 1u << JSON_OBJECT;
+            break;
+        default:
+            //Literals are checked once parsed, syntax errors are left to the parser
+            if(ch != u8'-' && !(ch >= u8'0' && ch <= u8'9'))
+                return true;
+            bits = 1u << JSON_NUMBER | JSON_SCHEMA_INTEGER;
+            break;
+        }
+        return s.types & bits;
+    }
+
+    bool json_schema_check(const JsonSchema &s, JsonValue &v)
+    {
+        //Checks on the value itself, children are checked by the caller
+        switch(v.get_type())
+        {
+        case JSON_NUMBER:
+        {
+            double n = v.get_number();
+            if(!(s.types & 1u << JSON_NUMBER) && (!(s.types & JSON_SCHEMA_INTEGER) || n != std::trunc(n)))
+                return false;
+            if((s.has_minimum && n < s.minimum) || (s.has_maximum && n > s.maximum))
+                return false;
+            break;
+        }
+        case JSON_STRING:
+        {
+            if(!(s.types & 1u << JSON_STRING))
+                return false;
+            if(s.max_length != SIZE_MAX)
+            {
+                //Length in code points, continuation bytes are not counted
+                size_t length = std::count_if(v.get_string().begin(), v.get_string().end(),
+                    [](char8_t ch) { return (ch & 0xC0) != 0x80; });
+                if(length > s.max_length)
+                    return false;
+            }
+            break;
+        }
+        case JSON_OBJECT:
+            if(!(s.types & 1u << JSON_OBJECT))
+                return false;
+            for(auto &i: s.required)
+                if(!v.get_object().contains(i))
+                    return false;
+            break;
+        default:
+            if(!(s.types & 1u << v.get_type()))
+                return false;
+            break;
+        }
+        if(!s.enumeration.empty() && std::find(s.enumeration.begin(), s.enumeration.end(), v) == s.enumeration.end())
+            return false;
+        return true;
+    }
+
+    int json_schema_violation(JsonContext &c, const char8_t *position)
+    {
+        if(c.schema_error)
+        {
+            c.schema_error->path = c.path;
+            c.schema_error->offset = position - c.source.data();
+        }
+        return PARSE_SCHEMA_VIOLATION;
+    }
+
+    void json_append_pointer(std::u8string &path, std::u8string_view key)
+    {
+        //JSON Pointer escaping: '~' -> "~0", '/' -> "~1"
+        path.push_back(u8'/');
+        for(auto ch: key)
+        {
+            if(ch == u8'~')
+                path += u8"~0";
+            else if(ch == u8'/')
+                path += u8"~1";
+            else
+                path.push_back(ch);
+        }
+    }
+
+    bool json_pointer_unescape(std::u8string_view escaped, std::u8string &token)
+    {
+        //JSON Pointer escaping: "~0" -> '~', "~1" -> '/'
+        token.clear();
+        for(size_t i = 0; i < escaped.size(); i++)
+        {
+            if(escaped[i] != u8'~')
+                token.push_back(escaped[i]);
+            else if(i + 1 < escaped.size() && (escaped[i + 1] == u8'0' || escaped[i + 1] == u8'1'))
+                token.push_back(escaped[++i] == u8'0' ? u8'~' : u8'/');
+            else
+                return false;
+        }
+        return true;
+    }
+
+    bool json_pointer_index(std::u8string_view token, size_t &index)
+    {
+        //Decimal index without leading zeros
+        auto [end, ec] = std::from_chars((const char *)token.data(), (const char *)token.data() + token.size(), index);
+        return !token.empty() && ec == std::errc() && end == (const char *)token.data() + token.size() &&
+               (token.size() == 1 || token[0] != u8'0');
+    }
+
+    JsonValue *json_find_pointer(JsonValue &v, std::u8string_view pointer)
+    {
+        JsonValue *current = &v;
+        std::u8string token;
+        while(!pointer.empty())
+        {
+            if(pointer[0] != u8'/')
+                return nullptr;
+            size_t end = pointer.find(u8'/', 1);
+            std::u8string_view escaped = pointer.substr(1, end == std::u8string_view::npos ? end : end - 1);
+            pointer = end == std::u8string_view::npos ? std::u8string_view() : pointer.substr(end);
+            if(!json_pointer_unescape(escaped, token))
+                return nullptr;
+
+            if(current->get_type() == JSON_OBJECT)
+            {
+                auto member = current->get_object().find(token);
+                if(member == current->get_object().end())
+                    return nullptr;
+                current = &member->second;
+            }
+            else if(current->get_type() == JSON_ARRAY)
+            {
+                size_t index = 0;
+                if(!json_pointer_index(token, index) || index >= current->get_array().size())
+                    return nullptr;
+                current = &current->get_array()[index];
+            }
+            else
+                return nullptr;
+        }
+        return current;
+    }
+
+    int json_validate(const JsonSchema &s, JsonValue &v, JsonSchemaError *error)
+    {
+        std::u8string path;
+        //Depth first, the path is extended on the way down
+        auto validate = [&path](auto &validate, const JsonSchema &s, JsonValue &v) -> bool {
+            if(!json_schema_check(s, v))
+                return false;
+            size_t path_length = path.length();
+            if(v.get_type() == JSON_ARRAY && s.items)
+            {
+                size_t index = 0;
+                for(auto &i: v.get_array())
+                {
+                    char buffer[24];
+                    path.push_back(u8'/');
+                    path.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), index++).ptr);
+                    if(!validate(validate, *s.items, i))
+                        return false;
+                    path.resize(path_length);
+                }
+            }
+            else if(v.get_type() == JSON_OBJECT)
+            {
+                for(auto &i: v.get_object())
+                {
+                    auto property = s.properties.find(i.first);
+                    const JsonSchema *child = property != s.properties.end() ? &property->second : s.additional.get();
+                    json_append_pointer(path, i.first);
+                    if(property == s.properties.end() && !s.additional_allowed)
+                        return false;
+                    if(child && !validate(validate, *child, i.second))
+                        return false;
+                    path.resize(path_length);
+                }
+            }
+            return true;
+        };
+        if(validate(validate, s, v))
+            return PARSE_OK;
+        if(error)
+        {
+            error->path = path;
+            error->offset = 0;
+        }
+        return PARSE_SCHEMA_VIOLATION;
+    }
+
+    JsonType JsonValue::get_type()
+    {
+        return type;
+    }
+
+    double JsonValue::get_number()
+    {
+        assert(type == JSON_NUMBER);
+        //Raw numbers are converted on first access
+        if(raw_number && !number_ready)
+        {
+            number = json_decode_number(text);
+            number_ready = true;
+        }
+        return number;
+    }
+
+    template<typename T>
+    T json_saturate(double d)
+    {
+        if(std::isnan(d))
+            return 0;
+        //The limits convert exactly, or round up to 2^63 and 2^64
+        if(d <= static_cast<double>(std::numeric_limits<T>::min()))
+            return std::numeric_limits<T>::min();
+        if(d >= static_cast<double>(std::numeric_limits<T>::max()))
+            return std::numeric_limits<T>::max();
+        return static_cast<T>(d);
+    }
+
+    int64_t JsonValue::get_int64()
+    {
+        assert(type == JSON_NUMBER);
+        int64_t n;
+        const char *begin = reinterpret_cast<const char *>(text.data()), *end = begin + text.size();
+        if(raw_number)
+        {
+            auto [ptr, ec] = std::from_chars(begin, end, n);
+            if(ec == std::errc() && ptr == end)
+                return n;
+        }
+        return json_saturate<int64_t>(get_number());
+    }
+
+    uint64_t JsonValue::get_uint64()
+    {
+        assert(type == JSON_NUMBER);
+        uint64_t n;
+        const char *begin = reinterpret_cast<const char *>(text.data()), *end = begin + text.size();
+        if(raw_number)
+        {
+            auto [ptr, ec] = std::from_chars(begin, end, n);
+            if(ec == std::errc() && ptr == end)
+                return n;
+        }
+        return json_saturate<uint64_t>(get_number());
+    }
+
+    std::u8string JsonValue::get_number_text()
+    {
+        assert(type == JSON_NUMBER);
+        if(raw_number)
+            return text;
+        //Shortest text that converts back to the same double
+        char buffer[32];
+        auto end = std::to_chars(buffer, buffer + sizeof(buffer), number).ptr;
+        return std::u8string(buffer, end);
+    }
+
+    double JsonValue::number_value() const
+    {
+        return raw_number && !number_ready ? json_decode_number(text) : number;
+    }
+
+    bool JsonValue::operator==(const JsonValue &v) const
+    {
+        if(type != v.type)
+            return false;
+        switch(type)
+        {
+        case JSON_NUMBER:
+        {
+            std::u8string_view a_text = raw_number ? text : std::u8string_view(), b_text = v.raw_number ? v.text : std::u8string_view();
+            return json_number_equal(number_value(), a_text, v.number_value(), b_text);
+        }
+        case JSON_STRING:
+            return text == v.text;
+        case JSON_ARRAY:
+            return array == v.array;
+        case JSON_OBJECT:
+            return object == v.object;
+        default:
+            return true;
+        }
+    }
+
+    std::u8string& JsonValue::get_string()
+    {
+        assert(type == JSON_STRING);
+        return text;
+    }
+
+    std::vector<JsonValue> &JsonValue::get_array()
+    {
+        assert(type == JSON_ARRAY);
+        return array;
+    }
+
+    std::map<std::u8string, JsonValue> &JsonValue::get_object()
+    {
+        assert(type == JSON_OBJECT);
+        return object;
+    }
+
+    JsonValue &JsonValue::operator=(const double v){
+        type = JSON_NUMBER;
+        number = v;
+        raw_number = false;
+
+        text.clear();
+        array.clear();
+        object.clear();
+        return *this;
+    }
+    JsonValue &JsonValue::operator=(const JsonType t) {
+        type = t;
+
+        number = 0.0;
+        raw_number = false;
+        text.clear();
+        array.clear();
+        object.clear();
+        return *this;
+    }
+    JsonValue &JsonValue::operator=(const char8_t* str)
+    {
+        type = JSON_STRING;
+        text = str;
+
+        number = 0.0;
+        raw_number = false;
+        array.clear();
+        object.clear();
+        return *this;
+    }
+
+    JsonValue &JsonValue::operator=(const std::u8string_view str)
+    {
+        type = JSON_STRING;
+        text = str;
+
+        number = 0.0;
+        raw_number = false;
+        array.clear();
+        object.clear();
+        return *this;
+    }
+    JsonValue &JsonValue::operator=(const std::vector<JsonValue> &a)
+    {
+        type = JSON_ARRAY;
+        array = a;
+
+        number = 0.0;
+        raw_number = false;
+        text.clear();
+        object.clear();
+        return *this;
+    }
+    JsonValue &JsonValue::operator=(const std::map<std::u8string, JsonValue> &o)
+    {
+        type = JSON_OBJECT;
+        object = o;
+
+        number = 0.0;
+        raw_number = false;
+        text.clear();
+        array.clear();
+        return *this;
+    }
+
+    int inline decode_utf8(int *state, int *codep, int byte);
+    std::u8string codepoint_to_string(int codepoint);
+    JsonMemoryUsage &JsonMemoryUsage::operator+=(const JsonMemoryUsage &other)
+    {
+        nodes += other.nodes;
+        strings += other.strings;
+        arrays += other.arrays;
+        objects += other.objects;
+        return *this;
+    }
+
+    JsonMemoryUsage JsonValue::memory_usage() const
+    {
+        //Storage kept from a previous type is counted too, it is still held
+        JsonMemoryUsage usage;
+        usage.nodes = (array.size() + object.size()) * sizeof(JsonValue);
+        usage.strings = json_string_heap(text.capacity());
+        usage.arrays = (array.capacity() - array.size()) * sizeof(JsonValue);
+        usage.objects = object.size() * (JSON_MEMBER_BYTES - sizeof(JsonValue));
+        for(const JsonValue &element : array)
+            usage += element.memory_usage();
+        for(const auto &[key, value] : object)
+        {
+            usage.strings += json_string_heap(key.capacity());
+            usage += value.memory_usage();
+        }
+        return usage;
+    }
+
+    std::u8string JsonValue::to_string()
+    {
+        std::u8string str;
+        write(str);
+        return str;
+    }
+
+    void JsonValue::write(std::u8string &str)
+    {
+        switch (type)
+        {
+        case JSON_ARRAY:
+            str.push_back(u8'[');
+            json_write_elements(str, array.begin(), array.end());
+            str.push_back(u8']');
+            break;
+        case JSON_OBJECT:
+            str.push_back(u8'{');
+            json_write_members(str, object.begin(), object.end());
+            str.push_back(u8'}');
+            break;
+        default:
+            json_write_scalar(str, type, number, text, raw_number);
+            break;
+        }
+    }
+
+    void json_write_scalar(std::u8string &str, JsonType type, double number, std::u8string_view text, bool raw_number)
+    {
+        switch (type)
+        {
+        case JSON_NULL:
+            str += u8"null";
+            break;
+        case JSON_FALSE:
+            str += u8"false";
+            break;
+        case JSON_TRUE:
+            str += u8"true";
+            break;
+        case JSON_NUMBER:
+        {
+            if(raw_number)
+            {
+                str += text;
+                break;
+            }
+            std::string temp = std::to_string(number);
+            str.append(temp.begin(), temp.end());
+            break;
+        }
+        case JSON_STRING:
+            json_encode_string(str, text);
+            break;
+        default:
+            break;
+        }
+    }
+
+    template<typename It>
+    void json_write_elements(std::u8string &str, It first, It last)
+    {
+        for(auto i = first; i != last; ++i)
+        {
+            if(i != first)
+                str.push_back(u8',');
+            i->write(str);
+        }
+    }
+
+    template<typename It>
+    void json_write_members(std::u8string &str, It first, It last)
+    {
+        for(auto i = first; i != last; ++i)
+        {
+            if(i != first)
+                str.push_back(u8',');
+            str.push_back(u8'"');
+            str += i->first;
+            str += u8"\":";
+            i->second.write(str);
+        }
+    }
+
+    void json_encode_string(std::u8string &str, std::u8string_view text, bool ascii)
+    {
+        str.push_back(u8'\"');
+        int codepoint = 0, state = 0;
+        for (auto s = text.begin(); s != text.end(); ++s)
+        {
+            //Keep UTF-8 sequences as they are
+            if(!ascii && *s >= 0x80)
+            {
+                str.push_back(*s);
+                continue;
+            }
+            if(decode_utf8(&state, &codepoint, *s))
+                continue;
+            switch(codepoint)
+            {
+            case u8'\\':
+                str += u8"\\\\";
+                break;
+            case u8'/':
+                if(ascii)
+                    str += u8"\\/";
+                else
+                    str.push_back(u8'/');
+                break;
+            case u8'\"':
+                str += u8"\\\"";
+                break;
+            case u8'\n':
+                str += u8"\\n";
+                break;
+            case u8'\b':
+                str += u8"\\b";
+                break;
+            case u8'\f':
+                str += u8"\\f";
+                break;
+            case u8'\t':
+                str += u8"\\t";
+                break;
+            case u8'\r':
+                str += u8"\\r";
+                break;
+            default:
+                if(codepoint >= 0x20 && codepoint < 0x7F)
+                    str.push_back(static_cast<char8_t>(codepoint));
+                else
+                    str += codepoint_to_string(codepoint);
+            }
+        }
+        str.push_back(u8'\"');
+    }
+
+    void JsonValue::set_number(double n)
+    {
+        number = n;
+        //Only the token of a raw number is dropped, a string keeps its text
+        if(raw_number)
+            text.clear();
+        raw_number = false;
+    }
+    void JsonValue::set_raw_number(std::u8string_view token)
+    {
+        text = token;
+        raw_number = true;
+        number_ready = false;
+    }
+    void JsonValue::set_type(JsonType t) { type = t; }
+    void JsonValue::reset(JsonType t)
+    {
+        //Release the storage of other types, keep the capacity used by t
+        type = t;
+        number = 0.0;
+        raw_number = false;
+        if(t != JSON_STRING)
+            text.clear();
+        if(t != JSON_ARRAY)
+            array.clear();
+        if(t != JSON_OBJECT)
+            object.clear();
+    }
+    void JsonValue::set_string(const std::u8string& str) { text = str; }
+    void JsonValue::set_array(const std::vector<JsonValue>& v) { array = v; }
+    void JsonValue::set_object(const std::map<std::u8string, JsonValue> &o) { object = o; }
+
+    bool json_is_whitespace(char8_t ch)
+    {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+    }
+
+    JsonEvent &json_event_error(JsonEvent &event, const std::vector<char8_t> &stack, int code, size_t depth)
+    {
+        //Errors inside an object value are reported as json_parse() does
+        if(code != PARSE_LIMIT_EXCEEDED && std::find(stack.begin(), stack.begin() + depth, u8'{') != stack.begin() + depth)
+            code = PARSE_INVALID_OBJECT_VALUE;
+        event = JsonEvent{JSON_EVENT_ERROR};
+        event.error = code;
+        return event;
+    }
+
+    JsonGenerator<JsonEvent> json_events(JsonInput &in, bool multiple)
+    {
+        JsonEvent need_more{JSON_EVENT_NEED_MORE}, event;
+        JsonContext c;
+        //Open containers, '[' or '{'
+        std::vector<char8_t> stack;
+        //Token spanning several chunks, decoded string
+        std::u8string token, text;
+        JsonEventState state = JSON_EXPECT_VALUE;
+        bool after_comma = false;
+
+        while(true)
+        {
+            //handle whitespace
+            while(true)
+            {
+                while(in.json.empty() && !in.closed)
+                    co_yield need_more;
+                size_t n = 0;
+                while(n < in.json.length() && json_is_whitespace(in.json[n]))
+                    ++n;
+                in.json.remove_prefix(n);
+                if(!in.json.empty() || in.closed)
+                    break;
+            }
+            bool end = in.json.empty();
+            char8_t ch = end ? u8'\0' : in.json.front();
+
+            if(state == JSON_EXPECT_NEXT)
+            {
+                if(stack.empty())
+                {
+                    if(end)
+                        co_return;
+                    if(!multiple)
+                    {
+                        co_yield json_event_error(event, stack, PARSE_ROOT_NOT_SINGULAR, 0);
+                        co_return;
+                    }
+                    state = JSON_EXPECT_VALUE;
+                    continue;
+                }
+                bool array = stack.back() == u8'[';
+                if(ch == (array ? u8']' : u8'}'))
+                {
+                    in.json.remove_prefix(1);
+                    stack.pop_back();
+                    event = JsonEvent{array ? JSON_EVENT_END_ARRAY : JSON_EVENT_END_OBJECT};
+                    co_yield event;
+                }
+                else if(ch == u8',')
+                {
+                    in.json.remove_prefix(1);
+                    state = array ? JSON_EXPECT_VALUE : JSON_EXPECT_KEY;
+                    after_comma = true;
+                }
+                else
+                {
+                    co_yield json_event_error(event, stack, array ? PARSE_INVAID_ARRAY_END : PARSE_INVAID_OBJECT_END, stack.size() - 1);
+                    co_return;
+                }
+                continue;
+            }
+
+            bool key = state == JSON_EXPECT_KEY;
+            if(key && ch != u8'\"')
+            {
+                if(ch == u8'}' && !after_comma)
+                {
+                    in.json.remove_prefix(1);
+                    stack.pop_back();
+                    state = JSON_EXPECT_NEXT;
+                    event = JsonEvent{JSON_EVENT_END_OBJECT};
+                    co_yield event;
+                    continue;
+                }
+                int code = end ? PARSE_INVAID_OBJECT_END : ch == u8'}' ? PARSE_EXTRA_OBJECT_SEPARATOR : PARSE_INVALID_OBJECT_KEY;
+                co_yield json_event_error(event, stack, code, stack.size() - 1);
+                co_return;
+            }
+            if(!key && end)
+            {
+                if(stack.empty() && multiple)
+                    co_return;
+                if(!stack.empty() && stack.back() == u8'[')
+                    co_yield json_event_error(event, stack, PARSE_INVAID_ARRAY_END, stack.size() - 1);
+                else
+                    co_yield json_event_error(event, stack, PARSE_EXPECT_VALUE, stack.size());
+                co_return;
+            }
+            if(!key && ch == u8']' && !stack.empty() && stack.back() == u8'[')
+            {
+                if(after_comma)
+                {
+                    co_yield json_event_error(event, stack, PARSE_EXTRA_ARRAY_SEPARATOR, stack.size() - 1);
+                    co_return;
+                }
+                in.json.remove_prefix(1);
+                stack.pop_back();
+                state = JSON_EXPECT_NEXT;
+                event = JsonEvent{JSON_EVENT_END_ARRAY};
+                co_yield event;
+                continue;
+            }
+            after_comma = false;
+
+            switch(ch)
+            {
+            case u8'[':
+            case u8'{':
+                in.json.remove_prefix(1);
+                stack.push_back(ch);
+                state = ch == u8'[' ? JSON_EXPECT_VALUE : JSON_EXPECT_KEY;
+                event = JsonEvent{ch == u8'[' ? JSON_EVENT_BEGIN_ARRAY : JSON_EVENT_BEGIN_OBJECT};
+                co_yield event;
+                continue;
+            case u8'\"':
+            {
+                //Find the closing quotation, escaped ones are skipped
+                token.clear();
+                bool escaped = false, found = false;
+                size_t n = 1;
+                while(true)
+                {
+                    for(; n < in.json.length(); ++n)
+                    {
+                        if(escaped)
+                            escaped = false;
+                        else if(in.json[n] == u8'\\')
+                            escaped = true;
+                        else if(in.json[n] == u8'\"')
+                        {
+                            found = true;
+                            ++n;
+                            break;
+                        }
+                    }
+                    if(found)
+                        break;
+                    if(in.json.size() > in.max_token - token.size())
+                    {
+                        co_yield json_event_error(event, stack, PARSE_LIMIT_EXCEEDED, stack.size());
+                        co_return;
+                    }
+                    token += in.json;
+                    in.json = std::u8string_view();
+                    n = 0;
+                    while(in.json.empty() && !in.closed)
+                        co_yield need_more;
+                    if(in.json.empty())
+                        break;
+                }
+                std::u8string_view raw = in.json.substr(0, n);
+                if(!token.empty())
+                {
+                    token += raw;
+                    raw = token;
+                }
+                in.json.remove_prefix(n);
+
+                //An unterminated string is decoded too, so that its escape
+                //errors are reported before the missing quotation
+                size_t end_pos = 0;
+                text.clear();
+                c.json = raw;
+                int ret = json_parse_string_raw(c, text, end_pos);
+                if(ret != PARSE_OK)
+                {
+                    if(key)
+                        co_yield json_event_error(event, stack, PARSE_INVALID_OBJECT_KEY, stack.size() - 1);
+                    else
+                        co_yield json_event_error(event, stack, ret, stack.size());
+                    co_return;
+                }
+                event = JsonEvent{key ? JSON_EVENT_KEY : JSON_EVENT_STRING};
+                event.text = text;
+                co_yield event;
+                if(!key)
+                {
+                    state = JSON_EXPECT_NEXT;
+                    continue;
+                }
+
+                //handle ':'
+                while(true)
+                {
+                    while(in.json.empty() && !in.closed)
+                        co_yield need_more;
+                    size_t n = 0;
+                    while(n < in.json.length() && json_is_whitespace(in.json[n]))
+                        ++n;
+                    in.json.remove_prefix(n);
+                    if(!in.json.empty() || in.closed)
+                        break;
+                }
+                if(!in.json.starts_with(u8":"))
+                {
+                    co_yield json_event_error(event, stack, PARSE_INVALID_OBJECT_SEPARATOR, stack.size() - 1);
+                    co_return;
+                }
+                in.json.remove_prefix(1);
+                state = JSON_EXPECT_VALUE;
+                continue;
+            }
+            case u8'n':
+            case u8'f':
+            case u8't':
+            {
+                std::u8string_view literal = ch == u8'n' ? u8"null" : ch == u8'f' ? u8"false" : u8"true";
+                size_t matched = 0;
+                while(matched < literal.length())
+                {
+                    while(in.json.empty() && !in.closed)
+                        co_yield need_more;
+                    if(in.json.empty() || in.json.front() != literal[matched])
+                        break;
+                    in.json.remove_prefix(1);
+                    ++matched;
+                }
+                if(matched != literal.length())
+                {
+                    co_yield json_event_error(event, stack, PARSE_INVALID_VALUE, stack.size());
+                    co_return;
+                }
+                event = JsonEvent{ch == u8'n' ? JSON_EVENT_NULL : ch == u8'f' ? JSON_EVENT_FALSE : JSON_EVENT_TRUE};
+                co_yield event;
+                state = JSON_EXPECT_NEXT;
+                continue;
+            }
+            default:
+            {
+                //Collect the characters that can extend a number, then validate them
+                token.clear();
+                bool point = false, exponent = false;
+                while(true)
+                {
+                    while(in.json.empty() && !in.closed)
+                        co_yield need_more;
+                    if(in.json.empty())
+                        break;
+                    char8_t next = in.json.front();
+                    char8_t last = token.empty() ? u8'\0' : token.back();
+                    //A leading zero ends the number, as in json_scan_number()
+                    if(next >= u8'0' && next <= u8'9' && (last == u8'0' && token.length() == 1 + (token[0] == u8'-')))
+                        break;
+                    if(next >= u8'0' && next <= u8'9')
+                        ;
+                    else if(next == u8'-' || next == u8'+')
+                    {
+                        if(!(next == u8'-' && token.empty()) && last != u8'e' && last != u8'E')
+                            break;
+                    }
+                    else if(next == u8'.' && !point && !exponent)
+                        point = true;
+                    else if((next == u8'e' || next == u8'E') && !exponent && !token.empty())
+                        exponent = true;
+                    else
+                        break;
+                    if(token.size() == in.max_token)
+                    {
+                        co_yield json_event_error(event, stack, PARSE_LIMIT_EXCEEDED, stack.size());
+                        co_return;
+                    }
+                    token.push_back(next);
+                    in.json.remove_prefix(1);
+                }
+                if(token.empty() || json_scan_number(token) != token.length())
+                {
+                    co_yield json_event_error(event, stack, PARSE_INVALID_VALUE, stack.size());
+                    co_return;
+                }
+                event = JsonEvent{JSON_EVENT_NUMBER};
+                event.text = token;
+                co_yield event;
+                state = JSON_EXPECT_NEXT;
+                continue;
+            }
+            }
+        }
+    }
+
+    JsonGenerator<JsonEvent> json_events(std::u8string_view json)
+    {
+        JsonInput in{json, true};
+        for(auto &e: json_events(in))
+            co_yield e;
+    }
+
+    void json_merge_patch(JsonValue &target, JsonValue patch)
+    {
+        if(patch.get_type() != JSON_OBJECT)
+        {
+            target = std::move(patch);
+            return;
+        }
+        if(target.get_type() != JSON_OBJECT)
+            target = std::map<std::u8string, JsonValue>();
+        auto &object = target.get_object();
+        for(auto &i : patch.get_object())
+        {
+            if(i.second.get_type() == JSON_NULL)
+                object.erase(i.first);
+            else
+                json_merge_patch(object[i.first], std::move(i.second));
+        }
+    }
+
+    // Splits pointer into the value holding the last token and the token
+    JsonValue *json_patch_parent(JsonValue &root, std::u8string_view pointer, std::u8string &token)
+    {
+        size_t last = pointer.rfind(u8'/');
+        if(last == std::u8string_view::npos || !json_pointer_unescape(pointer.substr(last + 1), token))
+            return nullptr;
+        return json_find_pointer(root, pointer.substr(0, last));
+    }
+
+    int json_patch_add(JsonValue &root, std::u8string_view path, JsonValue &value, std::vector<JsonPatchUndo> &undo)
+    {
+        if(path.empty())
+            return json_patch_replace(root, path, value, undo);
+        std::u8string token;
+        JsonValue *parent = json_patch_parent(root, path, token);
+        if(!parent)
+            return PARSE_PATCH_PATH_NOT_FOUND;
+        if(parent->get_type() == JSON_OBJECT)
+        {
+            auto [member, inserted] = parent->get_object().try_emplace(token);
+            if(inserted)
+                undo.push_back({JSON_PATCH_REMOVE, std::u8string(path), JsonValue()});
+            else
+                undo.push_back({JSON_PATCH_REPLACE, std::u8string(path), std::move(member->second)});
+            member->second = std::move(value);
+            return PARSE_OK;
+        }
+        if(parent->get_type() != JSON_ARRAY)
+            return PARSE_PATCH_PATH_NOT_FOUND;
+        auto &array = parent->get_array();
+        size_t index = array.size();
+        if(token != u8"-" && (!json_pointer_index(token, index) || index > array.size()))
+            return PARSE_PATCH_PATH_NOT_FOUND;
+        array.insert(array.begin() + index, std::move(value));
+        //"-" is undone at the index it resolved to
+        std::u8string inserted(path.substr(0, path.rfind(u8'/') + 1));
+        std::string digits = std::to_string(index);
+        inserted.append(digits.begin(), digits.end());
+        undo.push_back({JSON_PATCH_REMOVE, std::move(inserted), JsonValue()});
+        return PARSE_OK;
+    }
+
+    int json_patch_remove(JsonValue &root, std::u8string_view path, JsonValue &removed, std::vector<JsonPatchUndo> &undo)
+    {
+        std::u8string token;
+        JsonValue *parent = json_patch_parent(root, path, token);
+        if(!parent)
+            return PARSE_PATCH_PATH_NOT_FOUND;
+        if(parent->get_type() == JSON_OBJECT)
+        {
+            auto member = parent->get_object().find(token);
+            if(member == parent->get_object().end())
+                return PARSE_PATCH_PATH_NOT_FOUND;
+            removed = std::move(member->second);
+            parent->get_object().erase(member);
+        }
+        else if(parent->get_type() == JSON_ARRAY)
+        {
+            auto &array = parent->get_array();
+            size_t index = 0;
+            if(!json_pointer_index(token, index) || index >= array.size())
+                return PARSE_PATCH_PATH_NOT_FOUND;
+            removed = std::move(array[index]);
+            array.erase(array.begin() + index);
+        }
+        else
+            return PARSE_PATCH_PATH_NOT_FOUND;
+        //The value is restored from removed when undoing
+        undo.push_back({JSON_PATCH_ADD, std::u8string(path), JsonValue()});
+        return PARSE_OK;
+    }
+
+    int json_patch_replace(JsonValue &root, std::u8string_view path, JsonValue &value, std::vector<JsonPatchUndo> &undo)
+    {
+        JsonValue *target = json_find_pointer(root, path);
+        if(!target)
+            return PARSE_PATCH_PATH_NOT_FOUND;
+        undo.push_back({JSON_PATCH_REPLACE, std::u8string(path), std::move(*target)});
+        *target = std::move(value);
+        return PARSE_OK;
+    }
+
+    int json_patch(JsonValue &target, JsonValue patch)
+    {
+        static const std::map<std::u8string_view, JsonPatchOp> names = {
+            {u8"add", JSON_PATCH_ADD}, {u8"remove", JSON_PATCH_REMOVE}, {u8"replace", JSON_PATCH_REPLACE},
+            {u8"move", JSON_PATCH_MOVE}, {u8"copy", JSON_PATCH_COPY}, {u8"test", JSON_PATCH_TEST}};
+        if(patch.get_type() != JSON_ARRAY)
+            return PARSE_INVALID_PATCH;
+
+        std::vector<JsonPatchUndo> undo;
+        int ret = PARSE_OK;
+        for(auto &operation : patch.get_array())
+        {
+            if(operation.get_type() != JSON_OBJECT)
+            {
+                ret = PARSE_INVALID_PATCH;
+                break;
+            }
+            auto &members = operation.get_object();
+            auto string_member = [&members](const char8_t *name) -> const std::u8string * {
+                auto i = members.find(name);
+                return i != members.end() && i->second.get_type() == JSON_STRING ? &i->second.get_string() : nullptr;
+            };
+            const std::u8string *name = string_member(u8"op"), *path = string_member(u8"path");
+            const std::u8string *from = string_member(u8"from");
+            auto value = members.find(u8"value");
+            auto op = name ? names.find(*name) : names.end();
+            if(op == names.end() || !path ||
+               ((op->second == JSON_PATCH_MOVE || op->second == JSON_PATCH_COPY) && !from) ||
+               ((op->second == JSON_PATCH_ADD || op->second == JSON_PATCH_REPLACE || op->second == JSON_PATCH_TEST) &&
+                value == members.end()))
+            {
+                ret = PARSE_INVALID_PATCH;
+                break;
+            }
+
+            switch(op->second)
+            {
+            case JSON_PATCH_ADD:
+                ret = json_patch_add(target, *path, value->second, undo);
+                break;
+            case JSON_PATCH_REMOVE:
+            {
+                JsonValue removed;
+                ret = json_patch_remove(target, *path, removed, undo);
+                if(ret == PARSE_OK)
+                    undo.back().value = std::move(removed);
+                break;
+            }
+            case JSON_PATCH_REPLACE:
+                ret = json_patch_replace(target, *path, value->second, undo);
+                break;
+            case JSON_PATCH_MOVE:
+            {
+                //A value cannot be moved into one of its own children
+                if(path->starts_with(*from) && path->size() > from->size() && (*path)[from->size()] == u8'/')
+                {
+                    ret = PARSE_INVALID_PATCH;
+                    break;
+                }
+                if(*path == *from)
+                {
+                    ret = json_find_pointer(target, *path) ? PARSE_OK : PARSE_PATCH_PATH_NOT_FOUND;
+                    break;
+                }
+                JsonValue moved;
+                if((ret = json_patch_remove(target, *from, moved, undo)) != PARSE_OK)
+                    break;
+                size_t removal = undo.size() - 1;
+                ret = json_patch_add(target, *path, moved, undo);
+                if(ret == PARSE_OK)
+                    //Undoing the add takes the value out of the destination again
+                    undo[removal].carried = true;
+                else
+                    undo[removal].value = std::move(moved);
+                break;
+            }
+            case JSON_PATCH_COPY:
+            {
+                JsonValue *source = json_find_pointer(target, *from);
+                if(!source)
+                {
+                    ret = PARSE_PATCH_PATH_NOT_FOUND;
+                    break;
+                }
+                JsonValue copy = *source;
+                ret = json_patch_add(target, *path, copy, undo);
+                break;
+            }
+            case JSON_PATCH_TEST:
+            {
+                JsonValue *actual = json_find_pointer(target, *path);
+                ret = !actual ? PARSE_PATCH_PATH_NOT_FOUND : *actual == value->second ? PARSE_OK : PARSE_PATCH_TEST_FAILED;
+                break;
+            }
+            }
+            if(ret != PARSE_OK)
+                break;
+        }
+
+        if(ret != PARSE_OK)
+        {
+            //Each step is undone in reverse order, which cannot fail
+            std::vector<JsonPatchUndo> redo;
+            JsonValue carry;
+            while(!undo.empty())
+            {
+                JsonPatchUndo &u = undo.back();
+                if(u.op == JSON_PATCH_ADD)
+                    json_patch_add(target, u.path, u.carried ? carry : u.value, redo);
+                else if(u.op == JSON_PATCH_REMOVE)
+                    json_patch_remove(target, u.path, carry, redo);
+                else
+                {
+                    json_patch_replace(target, u.path, u.value, redo);
+                    carry = std::move(redo.back().value);
+                }
+                redo.clear();
+                undo.pop_back();
+            }
+        }
+        return ret;
+    }
+
+    JsonValue json_diff(JsonValue &from, JsonValue &to)
+    {
+        std::vector<JsonValue> patch;
+        std::u8string path;
+        json_diff(from, to, path, patch);
+        return JsonValue(std::move(patch));
+    }
+
+    JsonValue json_patch_operation(const char8_t *op, const std::u8string &path, const JsonValue *value)
+    {
+        std::map<std::u8string, JsonValue> operation;
+        operation[u8"op"] = op;
+        operation[u8"path"] = std::u8string_view(path);
+        if(value)
+            operation[u8"value"] = *value;
+        return JsonValue(operation);
+    }
+
+    void json_diff(JsonValue &from, JsonValue &to, std::u8string &path, std::vector<JsonValue> &patch)
+    {
+        size_t length = path.length();
+        if(from.get_type() != to.get_type() || (from.get_type() != JSON_ARRAY && from.get_type() != JSON_OBJECT))
+        {
+            if(!(from == to))
+                patch.push_back(json_patch_operation(u8"replace", path, &to));
+        }
+        else if(from.get_type() == JSON_OBJECT)
+        {
+            auto &a = from.get_object(), &b = to.get_object();
+            for(auto &i : a)
+            {
+                json_append_pointer(path, i.first);
+                auto other = b.find(i.first);
+                if(other == b.end())
+                    patch.push_back(json_patch_operation(u8"remove", path, nullptr));
+                else
+                    json_diff(i.second, other->second, path, patch);
+                path.resize(length);
+            }
+            for(auto &i : b)
+                if(!a.contains(i.first))
+                {
+                    json_append_pointer(path, i.first);
+                    patch.push_back(json_patch_operation(u8"add", path, &i.second));
+                    path.resize(length);
+                }
+        }
+        else
+        {
+            auto &a = from.get_array(), &b = to.get_array();
+            size_t prefix = 0, suffix = 0;
+            while(prefix < a.size() && prefix < b.size() && a[prefix] == b[prefix])
+                prefix++;
+            while(suffix < a.size() - prefix && suffix < b.size() - prefix &&
+                  a[a.size() - 1 - suffix] == b[b.size() - 1 - suffix])
+                suffix++;
+            size_t changed_a = a.size() - prefix - suffix, changed_b = b.size() - prefix - suffix;
+            auto index_path = [&](size_t index) {
+                path.resize(length);
+                path.push_back(u8'/');
+                std::string digits = std::to_string(index);
+                path.append(digits.begin(), digits.end());
+            };
+            for(size_t i = prefix; i < prefix + std::min(changed_a, changed_b); i++)
+            {
+                index_path(i);
+                json_diff(a[i], b[i], path, patch);
+            }
+            //Removed from the back, so the indexes stay valid
+            for(size_t i = prefix + changed_a; i-- > prefix + changed_b;)
+            {
+                index_path(i);
+                patch.push_back(json_patch_operation(u8"remove", path, nullptr));
+            }
+            for(size_t i = prefix + changed_a; i < prefix + changed_b; i++)
+            {
+                index_path(i);
+                patch.push_back(json_patch_operation(u8"add", path, &b[i]));
+            }
+            path.resize(length);
+        }
+    }
+
+    JsonTranscoder::JsonTranscoder(const JsonFormat &format) : format(format), events(json_events(in))
+    {
+    }
+
+    int JsonTranscoder::feed(std::u8string_view chunk, std::u8string &out)
+    {
+        in.feed(chunk);
+        return run(out);
+    }
+
+    int JsonTranscoder::finish(std::u8string &out)
+    {
+        in.close();
+        return run(out);
+    }
+
+    int JsonTranscoder::run(std::u8string &out)
+    {
+        while(ret == PARSE_OK && events.next())
+        {
+            const JsonEvent &e = events.value();
+            if(e.type == JSON_EVENT_NEED_MORE)
+                break;
+            if(e.type == JSON_EVENT_ERROR)
+                ret = e.error;
+            else
+                write(e, out);
+        }
+        return ret;
+    }
+
+    void JsonTranscoder::newline(std::u8string &out)
+    {
+        if(format.indent <= 0)
+            return;
+        out.push_back(u8'\n');
+        out.append(empty.size() * format.indent, u8' ');
+    }
+
+    void JsonTranscoder::write(const JsonEvent &e, std::u8string &out)
+    {
+        if(e.type == JSON_EVENT_END_ARRAY || e.type == JSON_EVENT_END_OBJECT)
+        {
+            bool was_empty = empty.back();
+            empty.pop_back();
+            if(!was_empty)
+                newline(out);
+            out.push_back(e.type == JSON_EVENT_END_ARRAY ? u8']' : u8'}');
+            return;
+        }
+
+        //Separator before a member or an element
+        if(after_key)
+            after_key = false;
+        else if(!empty.empty())
+        {
+            if(!empty.back())
+                out.push_back(u8',');
+            empty.back() = false;
+            newline(out);
+        }
+
+        switch(e.type)
+        {
+        case JSON_EVENT_NULL:
+            out += u8"null";
+            break;
+        case JSON_EVENT_FALSE:
+            out += u8"false";
+            break;
+        case JSON_EVENT_TRUE:
+            out += u8"true";
+            break;
+        case JSON_EVENT_NUMBER:
+            out += e.text;
+            break;
+        case JSON_EVENT_STRING:
+            json_encode_string(out, e.text, format.ascii);
+            break;
+        case JSON_EVENT_KEY:
+            json_encode_string(out, e.text, format.ascii);
+            out += format.indent > 0 ? u8": " : u8":";
+            after_key = true;
+            break;
+        case JSON_EVENT_BEGIN_ARRAY:
+        case JSON_EVENT_BEGIN_OBJECT:
+            out.push_back(e.type == JSON_EVENT_BEGIN_ARRAY ? u8'[' : u8'{');
+            empty.push_back(true);
+            break;
+        default:
+            break;
+        }
+    }
+
+    int json_transcode(std::u8string_view json, std::u8string &out, const JsonFormat &format)
+    {
+        JsonTranscoder transcoder(format);
+        int ret = transcoder.feed(json, out);
+        if(ret == PARSE_OK)
+            ret = transcoder.finish(out);
+        return ret;
+    }
+
+    JsonValueBuilder::JsonValueBuilder(JsonValue &v, const JsonParseOptions &options) : root(&v), raw_numbers(options.raw_numbers)
+    {
+        limits.max_bytes = options.max_bytes;
+        limits.max_values = options.max_values;
+        limits.max_length = options.max_length;
+        limits.memory_budget = options.memory_budget;
+        limits.limited = options.limited();
+    }
+
+    void JsonValueBuilder::reset(JsonValue &v)
+    {
+        root = &v;
+        stack.clear();
+        skip = 0;
+        limits.bytes = 0;
+        limits.values = 0;
+        ret = PARSE_OK;
+    }
+
+    bool JsonValueBuilder::exceeded()
+    {
+        ret = PARSE_LIMIT_EXCEEDED;
+        return false;
+    }
+
+    // Slot of the next value, nullptr when it belongs to a repeated key or
+    // breaks a limit
+    JsonValue *JsonValueBuilder::next()
+    {
+        if(limits.limited && ++limits.values > limits.max_values)
+        {
+            exceeded();
+            return nullptr;
+        }
+        if(stack.empty())
+            return root;
+        JsonValue &parent = *stack.back();
+        if(parent.get_type() == JSON_ARRAY)
+        {
+            if(limits.limited && !json_reserve_array(limits, parent.get_array()))
+            {
+                exceeded();
+                return nullptr;
+            }
+            return &parent.get_array().emplace_back();
+        }
+        auto &object = parent.get_object();
+        if(limits.limited && !object.contains(key) &&
+           (object.size() == limits.max_length || !json_charge(limits, JSON_MEMBER_BYTES + json_string_heap(key.size()))))
+        {
+            exceeded();
+            return nullptr;
+        }
+        //The first occurrence of a key wins
+        auto [member, inserted] = object.try_emplace(key);
+        return inserted ? &member->second : nullptr;
+    }
+
+    bool JsonValueBuilder::add(const JsonEvent &e)
+    {
+        if(ret != PARSE_OK)
+            return false;
+        bool begin = e.type == JSON_EVENT_BEGIN_ARRAY || e.type == JSON_EVENT_BEGIN_OBJECT;
+        if(skip)
+        {
+            if(begin)
+                skip++;
+            else if(e.type == JSON_EVENT_END_ARRAY || e.type == JSON_EVENT_END_OBJECT)
+                skip--;
+            //Dropped values still count, as in json_parse()
+            if((e.type <= JSON_EVENT_STRING || begin) && limits.limited && ++limits.values > limits.max_values)
+                return exceeded();
+            return false;
+        }
+        JsonValue *v = nullptr;
+        if((e.type <= JSON_EVENT_STRING || begin) && !(v = next()))
+        {
+            skip = begin;
+            return false;
+        }
+
+        switch(e.type)
+        {
+        case JSON_EVENT_NULL:
+        case JSON_EVENT_FALSE:
+        case JSON_EVENT_TRUE:
+            *v = static_cast<JsonType>(e.type);
+            break;
+        case JSON_EVENT_NUMBER:
+            v->reset(JSON_NUMBER);
+            if(raw_numbers && limits.limited && !json_reserve_string(limits, v->text, e.text.size()))
+                return exceeded();
+            if(raw_numbers)
+                v->set_raw_number(e.text);
+            else
+            {
+                double number = json_decode_number(e.text);
+                if(std::isinf(number))
+                {
+                    ret = PARSE_NUMBER_TOO_BIG;
+                    return false;
+                }
+                v->set_number(number);
+            }
+            break;
+        case JSON_EVENT_STRING:
+            v->reset(JSON_STRING);
+            if(limits.limited && (e.text.size() > limits.max_length || !json_reserve_string(limits, v->text, e.text.size())))
+                return exceeded();
+            v->text = e.text;
+            break;
+        case JSON_EVENT_KEY:
+            if(limits.limited && (e.text.size() > limits.max_length || !json_reserve_string(limits, key, e.text.size())))
+                return exceeded();
+            key = e.text;
+            return false;
+        case JSON_EVENT_BEGIN_ARRAY:
+            *v = std::vector<JsonValue>();
+            stack.push_back(v);
+            return false;
+        case JSON_EVENT_BEGIN_OBJECT:
+            *v = std::map<std::u8string, JsonValue>();
+            stack.push_back(v);
+            return false;
+        case JSON_EVENT_END_ARRAY:
+        case JSON_EVENT_END_OBJECT:
+            stack.pop_back();
+            break;
+        default:
+            return false;
+        }
+        return stack.empty();
+    }
+
+    // Lazily computed hash of a node, 0 until known. Copies start unknown.
+    struct JsonHashCache
+    {
+        mutable std::atomic<uint64_t> value = 0;
+        JsonHashCache() = default;
+        JsonHashCache(const JsonHashCache &) {}
+        JsonHashCache &operator=(const JsonHashCache &) { value.store(0, std::memory_order_relaxed); return *this; }
+    };
+
+    struct JsonSharedValue::Node
+    {
+        JsonType type = JSON_NULL;
+        double number = 0.0;
+        //String, or the original token of a raw number
+        std::u8string text;
+        std::vector<JsonSharedValue> array;
+        std::map<std::u8string, JsonSharedValue, std::less<>> object;
+        JsonHashCache hash;
+    };
+
+    JsonSharedValue::JsonSharedValue(JsonType t) : node(std::make_shared<Node>())
+    {
+        node->type = t;
+    }
+
+    JsonSharedValue::JsonSharedValue(double n) : node(std::make_shared<Node>())
+    {
+        node->type = JSON_NUMBER;
+        node->number = n;
+    }
+
+    JsonSharedValue::JsonSharedValue(const char8_t *s) : node(std::make_shared<Node>())
+    {
+        node->type = JSON_STRING;
+        node->text = s;
+    }
+
+    JsonSharedValue::JsonSharedValue(const JsonValue &v) : node(std::make_shared<Node>())
+    {
+        node->type = v.type;
+        switch(v.type)
+        {
+        case JSON_NUMBER:
+            //Converted once here, as shared nodes are never modified
+            node->number = v.number_value();
+            if(v.raw_number)
+                node->text = v.text;
+            break;
+        case JSON_STRING:
+            node->text = v.text;
+            break;
+        case JSON_ARRAY:
+            node->array.assign(v.array.begin(), v.array.end());
+            break;
+        case JSON_OBJECT:
+            for(auto &i: v.object)
+                node->object.emplace_hint(node->object.end(), i.first, i.second);
+            break;
+        default:
+            break;
+        }
+    }
+
+    JsonType JsonSharedValue::get_type() const
+    {
+        return node ? node->type : JSON_NULL;
+    }
+
+    double JsonSharedValue::get_number() const
+    {
+        assert(get_type() == JSON_NUMBER);
+        return node->number;
+    }
+
+    const std::u8string &JsonSharedValue::get_string() const
+    {
+        assert(get_type() == JSON_STRING);
+        return node->text;
+    }
+
+    const std::vector<JsonSharedValue> &JsonSharedValue::get_array() const
+    {
+        assert(get_type() == JSON_ARRAY);
+        return node->array;
+    }
+
+    const std::map<std::u8string, JsonSharedValue, std::less<>> &JsonSharedValue::get_object() const
+    {
+        assert(get_type() == JSON_OBJECT);
+        return node->object;
+    }
+
+    size_t JsonSharedValue::size() const
+    {
+        switch(get_type())
+        {
+        case JSON_ARRAY:
+            return node->array.size();
+        case JSON_OBJECT:
+            return node->object.size();
+        default:
+            return 0;
+        }
+    }
+
+    const JsonSharedValue &JsonSharedValue::operator[](size_t index) const
+    {
+        assert(get_type() == JSON_ARRAY && index < node->array.size());
+        return node->array[index];
+    }
+
+    const JsonSharedValue *JsonSharedValue::find(std::u8string_view key) const
+    {
+        assert(get_type() == JSON_OBJECT);
+        auto i = node->object.find(key);
+        return i == node->object.end() ? nullptr : &i->second;
+    }
+
+    JsonSharedValue::Node &JsonSharedValue::detach()
+    {
+        if(!node)
+            node = std::make_shared<Node>();
+        else if(node.use_count() != 1)
+            //Shallow copy: the children are shared by the two nodes
+            node = std::make_shared<Node>(*node);
+        else
+        {
+            //Pairs with the release of the last other owner
+            std::atomic_thread_fence(std::memory_order_acquire);
+            node->hash.value.store(0, std::memory_order_relaxed);
+        }
+        return *node;
+    }
+
+    JsonSharedValue &JsonSharedValue::set(size_t index, JsonSharedValue v)
+    {
+        assert(get_type() == JSON_ARRAY && index < node->array.size());
+        detach().array[index] = std::move(v);
+        return *this;
+    }
+
+    JsonSharedValue &JsonSharedValue::set(std::u8string_view key, JsonSharedValue v)
+    {
+        assert(get_type() == JSON_OBJECT);
+        auto &object = detach().object;
+        auto i = object.find(key);
+        if(i == object.end())
+            object.emplace(key, std::move(v));
+        else
+            i->second = std::move(v);
+        return *this;
+    }
+
+    JsonSharedValue &JsonSharedValue::push_back(JsonSharedValue v)
+    {
+        assert(get_type() == JSON_ARRAY);
+        detach().array.push_back(std::move(v));
+        return *this;
+    }
+
+    bool JsonSharedValue::erase(std::u8string_view key)
+    {
+        assert(get_type() == JSON_OBJECT);
+        if(node->object.find(key) == node->object.end())
+            return false;
+        auto &object = detach().object;
+        object.erase(object.find(key));
+        return true;
+    }
+
+    JsonSharedValue &JsonSharedValue::modify(size_t index)
+    {
+        assert(get_type() == JSON_ARRAY && index < node->array.size());
+        return detach().array[index];
+    }
+
+    JsonSharedValue &JsonSharedValue::modify(std::u8string_view key)
+    {
+        assert(get_type() == JSON_OBJECT);
+        auto &object = detach().object;
+        auto i = object.find(key);
+        if(i == object.end())
+            i = object.emplace(key, JsonSharedValue()).first;
+        return i->second;
+    }
+
+    bool JsonSharedValue::is_same(const JsonSharedValue &v) const
+    {
+        return node == v.node;
+    }
+
+    bool JsonSharedValue::operator==(const JsonSharedValue &v) const
+    {
+        if(is_same(v))
+            return true;
+        if(get_type() != v.get_type())
+            return false;
+        switch(get_type())
+        {
+        case JSON_NUMBER:
+            return json_number_equal(node->number, node->text, v.node->number, v.node->text);
+        case JSON_STRING:
+            return node->text == v.node->text;
+        case JSON_ARRAY:
+            return node->array == v.node->array;
+        case JSON_OBJECT:
+            return node->object == v.node->object;
+        default:
+            return true;
+        }
+    }
+
+    JsonValue JsonSharedValue::to_value() const
+    {
+        JsonValue v(get_type());
+        switch(get_type())
+        {
+        case JSON_NUMBER:
+            if(!node->text.empty())
+            {
+                v.set_raw_number(node->text);
+                v.number_ready = true;
+            }
+            v.number = node->number;
+            break;
+        case JSON_STRING:
+            v.text = node->text;
+            break;
+        case JSON_ARRAY:
+            v.array.reserve(node->array.size());
+            for(auto &i: node->array)
+                v.array.push_back(i.to_value());
+            break;
+        case JSON_OBJECT:
+            for(auto &i: node->object)
+                v.object.emplace_hint(v.object.end(), i.first, i.second.to_value());
+            break;
+        default:
+            break;
+        }
+        return v;
+    }
+
+    std::u8string JsonSharedValue::to_string() const
+    {
+        std::u8string str;
+        write(str);
+        return str;
+    }
+
+    void JsonSharedValue::write(std::u8string &str) const
+    {
+        switch(get_type())
+        {
+        case JSON_ARRAY:
+            str.push_back(u8'[');
+            json_write_elements(str, node->array.begin(), node->array.end());
+            str.push_back(u8']');
+            break;
+        case JSON_OBJECT:
+            str.push_back(u8'{');
+            json_write_members(str, node->object.begin(), node->object.end());
+            str.push_back(u8'}');
+            break;
+        default:
+            //Only raw numbers keep their text
+            if(node)
+                json_write_scalar(str, node->type, node->number, node->text, !node->text.empty());
+            else
+                json_write_scalar(str, JSON_NULL, 0.0, std::u8string_view(), false);
+            break;
+        }
+    }
+
+    size_t JsonSharedValue::memory_usage() const
+    {
+        if(!node)
+            return 0;
+        size_t bytes = node_usage();
+        for(auto &i : node->array)
+            bytes += i.memory_usage();
+        for(auto &i : node->object)
+            bytes += i.second.memory_usage();
+        return bytes;
+    }
+
+    // Bytes of the node itself, without its children
+    size_t JsonSharedValue::node_usage() const
+    {
+        //Node and reference counts share one make_shared allocation
+        size_t bytes = sizeof(Node) + 2 * sizeof(long);
+        if(node->text.capacity() > std::u8string().capacity())
+            bytes += node->text.capacity() + 1;
+        bytes += node->array.capacity() * sizeof(JsonSharedValue);
+        for(auto &i : node->object)
+        {
+            //Tree node links, colour and the pair
+            bytes += 4 * sizeof(void *) + sizeof(i);
+            if(i.first.capacity() > std::u8string().capacity())
+                bytes += i.first.capacity() + 1;
+        }
+        return bytes;
+    }
+
+    uint64_t JsonSharedValue::hash() const
+    {
+        if(!node)
+            return JSON_NULL + 1;
+        uint64_t h = node->hash.value.load(std::memory_order_relaxed);
+        if(h)
+            return h;
+
+        auto mix = [&h](uint64_t v) { h = std::rotl((h ^ v) * 0x9E3779B185EBCA87ull, 29); };
+        h = node->type + 1;
+        switch(node->type)
+        {
+        case JSON_NUMBER:
+        {
+            //By value like operator==, -0 and 0 are equal. Raw integers that
+            //differ beyond the precision of a double only share a hash.
+            double n = node->number + 0.0;
+            uint64_t bits;
+            memcpy(&bits, &n, sizeof(bits));
+            mix(bits);
+            break;
+        }
+        case JSON_STRING:
+            mix(json_hash_bytes(node->text));
+            break;
+        case JSON_ARRAY:
+            for(auto &i : node->array)
+                mix(i.hash());
+            break;
+        case JSON_OBJECT:
+            for(auto &i : node->object)
+            {
+                mix(json_hash_bytes(i.first));
+                mix(i.second.hash());
+            }
+            break;
+        default:
+            break;
+        }
+        h ^= h >> 31;
+        h += !h;
+        node->hash.value.store(h, std::memory_order_relaxed);
+        return h;
+    }
+
+    bool JsonInterner::identical(const JsonSharedValue &a, const JsonSharedValue &b)
+    {
+        const JsonSharedValue::Node &x = *a.node, &y = *b.node;
+        if(x.type != y.type || x.text != y.text || x.array.size() != y.array.size() ||
+           x.object.size() != y.object.size() ||
+           (x.type == JSON_NUMBER && std::bit_cast<uint64_t>(x.number) != std::bit_cast<uint64_t>(y.number)))
+            return false;
+        for(size_t i = 0; i < x.array.size(); i++)
+            if(!x.array[i].is_same(y.array[i]))
+                return false;
+        for(auto i = x.object.begin(), j = y.object.begin(); i != x.object.end(); ++i, ++j)
+            if(i->first != j->first || !i->second.is_same(j->second))
+                return false;
+        return true;
+    }
+
+    uint64_t JsonInterner::key(const JsonSharedValue &v)
+    {
+        uint64_t h = v.hash();
+        if(v.node->type == JSON_NUMBER)
+            h ^= std::bit_cast<uint64_t>(v.node->number);
+        return h;
+    }
+
+    void JsonInterner::intern(JsonSharedValue &v)
+    {
+        if(!v.node)
+            return;
+        auto range = values.equal_range(key(v));
+        for(auto i = range.first; i != range.second; ++i)
+            if(i->second.is_same(v))
+                return;
+        //Children first, so that equal children are already the same node.
+        //Replacing them does not change the value, so a node nothing else
+        //holds is updated in place; a shared one is copied on write.
+        bool owned = v.node.use_count() == 1;
+        if(owned)
+            v.detach();
+        for(size_t i = 0; i < v.node->array.size(); i++)
+        {
+            if(owned)
+            {
+                intern(v.node->array[i]);
+                continue;
+            }
+            JsonSharedValue child = v.node->array[i];
+            intern(child);
+            if(!child.is_same(v.node->array[i]))
+                v.detach().array[i] = std::move(child);
+        }
+        for(auto i = v.node->object.begin(); i != v.node->object.end(); ++i)
+        {
+            if(owned)
+            {
+                intern(i->second);
+                continue;
+            }
+            JsonSharedValue child = i->second;
+            intern(child);
+            if(!child.is_same(i->second))
+            {
+                //detach() may copy the node, so look the member up again
+                std::u8string key = i->first;
+                auto &object = v.detach().object;
+                i = object.find(key);
+                i->second = std::move(child);
+            }
+        }
+
+        range = values.equal_range(key(v));
+        for(auto i = range.first; i != range.second; ++i)
+        {
+            if(identical(i->second, v))
+            {
+                //Only released when nothing else holds it
+                if(v.node.use_count() == 1)
+                    saved += v.node_usage();
+                v = i->second;
+                return;
+            }
+        }
+        values.emplace(key(v), v);
+    }
+
+    void JsonInterner::clear()
+    {
+        values.clear();
+        saved = 0;
+    }
+
+    size_t json_dedup(JsonSharedValue &v)
+    {
+        JsonInterner interner;
+        interner.intern(v);
+        return interner.bytes_saved();
+    }
+
+    int json_parse(JsonSharedValue &v, std::u8string_view json, JsonInterner &interner, bool raw_numbers)
+    {
+        return json_parse_shared(v, json, &interner, raw_numbers);
+    }
+
+    int json_parse(JsonSharedValue &v, std::u8string_view json, const JsonParseOptions &options)
+    {
+        if(!options.schema && !options.limited())
+            return json_parse_shared(v, json, nullptr, options.raw_numbers);
+        JsonValue parsed;
+        int ret = json_parse(parsed, json, options);
+        v = ret == PARSE_OK ? JsonSharedValue(parsed) : JsonSharedValue();
+        return ret;
+    }
+
+    // Builds v from the events of json. With an interner, every value is
+    // interned as soon as it is complete.
+    int json_parse_shared(JsonSharedValue &v, std::u8string_view json, JsonInterner *interner, bool raw_numbers)
+    {
+        //Containers being built, with the key each one is stored under. They
+        //are owned by this function only, so their nodes are filled in place.
+        std::vector<std::pair<JsonSharedValue, std::u8string>> stack;
+        std::u8string key;
+        v = JsonSharedValue();
+        auto add = [&](JsonSharedValue value) {
+            if(interner)
+                interner->intern(value);
+            if(stack.empty())
+                v = std::move(value);
+            else if(stack.back().first.node->type == JSON_ARRAY)
+                stack.back().first.node->array.push_back(std::move(value));
+            //The first occurrence of a key wins, like json_parse()
+            else
+                stack.back().first.node->object.try_emplace(key, std::move(value));
+        };
+        for(auto &e : json_events(json))
+        {
+            switch(e.type)
+            {
+            case JSON_EVENT_ERROR:
+                v = JsonSharedValue();
+                return e.error;
+            case JSON_EVENT_NULL:
+            case JSON_EVENT_FALSE:
+            case JSON_EVENT_TRUE:
+                add(JsonSharedValue(static_cast<JsonType>(e.type)));
+                break;
+            case JSON_EVENT_NUMBER:
+            {
+                JsonSharedValue number(json_decode_number(e.text));
+                if(!raw_numbers && std::isinf(number.node->number))
+                {
+                    v = JsonSharedValue();
+                    return PARSE_NUMBER_TOO_BIG;
+                }
+                if(raw_numbers)
+                    number.node->text = e.text;
+                add(std::move(number));
+                break;
+            }
+            case JSON_EVENT_STRING:
+            {
+                JsonSharedValue string(JSON_STRING);
+                string.node->text = e.text;
+                add(std::move(string));
+                break;
+            }
+            case JSON_EVENT_KEY:
+                key = e.text;
+                break;
+            case JSON_EVENT_BEGIN_ARRAY:
+            case JSON_EVENT_BEGIN_OBJECT:
+                stack.emplace_back(JsonSharedValue(e.type == JSON_EVENT_BEGIN_ARRAY ? JSON_ARRAY : JSON_OBJECT), std::move(key));
+                break;
+            case JSON_EVENT_END_ARRAY:
+            case JSON_EVENT_END_OBJECT:
+            {
+                JsonSharedValue value = std::move(stack.back().first);
+                key = std::move(stack.back().second);
+                stack.pop_back();
+                add(std::move(value));
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        return PARSE_OK;
+    }
+
+    JsonValue JsonStaticValue::to_value() const
+    {
+        JsonValue v(get_type());
+        switch(get_type())
+        {
+        case JSON_NUMBER:
+            v.set_raw_number(get_number_text());
+            break;
+        case JSON_STRING:
+            v = get_string();
+            break;
+        case JSON_ARRAY:
+            for(size_t child = node().first; child; child = nodes[child].next)
+                v.get_array().push_back(JsonStaticValue(nodes, chars, child).to_value());
+            break;
+        case JSON_OBJECT:
+            for(size_t child = node().first; child; child = nodes[child].next)
+            {
+                JsonStaticValue member(nodes, chars, child);
+                v.get_object().try_emplace(std::u8string(member.get_key()), member.to_value());
+            }
+            break;
+        default:
+            break;
+        }
+        return v;
+    }
+
+    void json_static_parse_failed(int) {}
+
+    // Byte string whose order is the order of the keys: the type, then the
+    // string bytes or the number's bits mapped to big-endian unsigned order.
+    std::u8string json_index_key(const JsonValue &v)
+    {
+        std::u8string key(1, char8_t(v.type));
+        if(v.type == JSON_STRING)
+            key += v.text;
+        else if(v.type == JSON_NUMBER)
+        {
+            //-0 and 0 are the same key
+            double n = v.number_value() + 0.0;
+            uint64_t bits;
+            memcpy(&bits, &n, sizeof(bits));
+            bits = bits >> 63 ? ~bits : bits | 1ull << 63;
+            for(int shift = 56; shift >= 0; shift -= 8)
+                key.push_back(char8_t(bits >> shift));
+            //Then the exact offset of a 64-bit raw integer from that double,
+            //which tells apart and orders integers beyond 2^53. It is at most
+            //half a step between doubles, 2^11, so the key stays inline.
+            uint16_t offset = uint16_t(json_index_offset(v, n) + 0x8000);
+            key.push_back(char8_t(offset >> 8));
+            key.push_back(char8_t(offset));
+        }
+        return key;
+    }
+
+    int64_t json_index_offset(const JsonValue &v, double n)
+    {
+        if(!v.raw_number)
+            return 0;
+        //The offsets are small, so they are exact in wrapping arithmetic
+        const char *begin = reinterpret_cast<const char *>(v.text.data()), *end = begin + v.text.size();
+        int64_t i;
+        uint64_t u;
+        if(auto [ptr, ec] = std::from_chars(begin, end, i); ec == std::errc() && ptr == end)
+            return int64_t(uint64_t(i) - (n >= 0x1p63 ? 1ull << 63 : uint64_t(int64_t(n))));
+        if(auto [ptr, ec] = std::from_chars(begin, end, u); ec == std::errc() && ptr == end)
+            return int64_t(u - (n >= 0x1p64 ? 0 : uint64_t(n)));
+        return 0;
+    }
+
+    JsonIndex::JsonIndex(JsonValue &array, std::u8string_view pointer, JsonIndexType type) :
+        array(&array), pointer(pointer), type(type)
+    {
+        rebuild();
+    }
+
+    bool JsonIndex::stale()
+    {
+        return array->get_array().size() != size || array->get_array().data() != data;
+    }
+
+    bool JsonIndex::key_of(size_t index, std::u8string &key)
+    {
+        JsonValue *v = json_find_pointer(array->get_array()[index], pointer);
+        if(!v || v->get_type() == JSON_ARRAY || v->get_type() == JSON_OBJECT)
+            return false;
+        key = json_index_key(*v);
+        return true;
+    }
+
+    void JsonIndex::insert(size_t index, size_t slot)
+    {
+        std::u8string key;
+        if(!key_of(index, key))
+            return;
+        if(type == JSON_INDEX_SORTED)
+        {
+            sorted_entries.resize(live.size() - 1);
+            sorted_entries[slot] = sorted.emplace(std::move(key), slot);
+            return;
+        }
+        hash_entries.resize(live.size() - 1);
+        size_t buckets = hash.bucket_count();
+        auto entry = hash.emplace(std::move(key), slot);
+        hash_entries[slot] = entry;
+        //A rehash invalidates the iterators of every entry
+        if(hash.bucket_count() != buckets)
+            for(auto i = hash.begin(); i != hash.end(); ++i)
+                hash_entries[i->second] = i;
+    }
+
+    void JsonIndex::remove(size_t index, size_t slot)
+    {
+        std::u8string key;
+        if(!key_of(index, key))
+            return;
+        if(type == JSON_INDEX_HASH)
+            hash.erase(hash_entries[slot]);
+        else
+            sorted.erase(sorted_entries[slot]);
+    }
+
+    // Number of live slots before slot, which is its position in the array
+    size_t JsonIndex::position(size_t slot) const
+    {
+        size_t count = 0;
+        for(size_t i = slot; i > 0; i -= i & -i)
+            count += live[i];
+        return count;
+    }
+
+    size_t JsonIndex::slot_at(size_t position) const
+    {
+        //Descends to the last node whose prefix holds at most position live slots
+        size_t slot = 0;
+        for(size_t step = std::bit_floor(live.size()); step; step >>= 1)
+            if(slot + step < live.size() && live[slot + step] <= position)
+            {
+                slot += step;
+                position -= live[slot];
+            }
+        return slot;
+    }
+
+    void JsonIndex::add_slot()
+    {
+        //The new node covers itself and the slots since i - lowbit(i)
+        size_t i = live.size();
+        live.push_back(1 + position(i - 1) - position(i - (i & -i)));
+    }
+
+    void JsonIndex::erase_slot(size_t slot)
+    {
+        for(size_t i = slot + 1; i < live.size(); i += i & -i)
+            --live[i];
+        ++erased;
+    }
+
+    void JsonIndex::rebuild()
+    {
+        hash.clear();
+        sorted.clear();
+        std::vector<JsonValue> &elements = array->get_array();
+        if(type == JSON_INDEX_HASH)
+            hash.reserve(elements.size());
+        live.assign(elements.size() + 1, 0);
+        for(size_t i = 1; i < live.size(); i++)
+        {
+            live[i] += 1;
+            if(i + (i & -i) < live.size())
+                live[i + (i & -i)] += live[i];
+        }
+        erased = 0;
+        for(size_t i = 0; i < elements.size(); i++)
+            insert(i, i);
+        size = elements.size();
+        data = elements.data();
+    }
+
+    JsonValue *JsonIndex::find(const JsonValue &key)
+    {
+        if(stale())
+            rebuild();
+        std::u8string k = json_index_key(key);
+        if(type == JSON_INDEX_HASH)
+        {
+            auto i = hash.find(k);
+            return i == hash.end() ? nullptr : &array->get_array()[position(i->second)];
+        }
+        auto i = sorted.find(k);
+        return i == sorted.end() ? nullptr : &array->get_array()[position(i->second)];
+    }
+
+    std::vector<JsonValue *> JsonIndex::find_all(const JsonValue &key)
+    {
+        if(stale())
+            rebuild();
+        std::vector<JsonValue *> result;
+        std::u8string k = json_index_key(key);
+        auto collect = [&](auto range) {
+            for(auto i = range.first; i != range.second; ++i)
+                result.push_back(&array->get_array()[position(i->second)]);
+        };
+        if(type == JSON_INDEX_HASH)
+            collect(hash.equal_range(k));
+        else
+            collect(sorted.equal_range(k));
+        return result;
+    }
+
+    std::vector<JsonValue *> JsonIndex::range(const JsonValue &low, const JsonValue &high)
+    {
+        assert(type == JSON_INDEX_SORTED);
+        if(stale())
+            rebuild();
+        std::vector<JsonValue *> result;
+        auto end = sorted.upper_bound(json_index_key(high));
+        for(auto i = sorted.lower_bound(json_index_key(low)); i != end; ++i)
+            result.push_back(&array->get_array()[position(i->second)]);
+        return result;
     }
 
-    int json_parse_string(JsonContext &c, JsonValue &v)
+    void JsonIndex::push_back(JsonValue v)
     {
-        int ret = PARSE_OK;
-        size_t end_quotation_pos = 0;
-        std::u8string temp;
-        if((ret = json_parse_string_raw(c, temp, end_quotation_pos)) != PARSE_OK)
-            return ret;
-        v.set_type(JSON_STRING);
-        v.set_string(temp);
-        c.json = c.json.substr(end_quotation_pos);
-        return PARSE_OK;
+        if(stale())
+            rebuild();
+        array->get_array().push_back(std::move(v));
+        add_slot();
+        insert(array->get_array().size() - 1, live.size() - 2);
+        size = array->get_array().size();
+        data = array->get_array().data();
     }
 
-    std::u8string json_encode_utf8(unsigned codepoint)
+    void JsonIndex::set(size_t index, JsonValue v)
+    {
+        if(stale())
+            rebuild();
+        size_t slot = slot_at(index);
+        remove(index, slot);
+        array->get_array()[index] = std::move(v);
+        insert(index, slot);
+    }
+
+    void JsonIndex::erase(size_t index)
+    {
+        if(stale())
+            rebuild();
+        size_t slot = slot_at(index);
+        remove(index, slot);
+        erase_slot(slot);
+        std::vector<JsonValue> &elements = array->get_array();
+        elements.erase(elements.begin() + index);
+        size = elements.size();
+        data = elements.data();
+        //Renumber once erased slots outnumber the live ones
+        if(erased > size)
+            rebuild();
+    }
+
+    JsonThreadPool::JsonThreadPool(unsigned threads)
+    {
+        if(threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        for(unsigned i = 0; i < threads; i++)
+            workers.push_back(std::make_unique<Worker>());
+        //Worker 0 is the thread calling run()
+        for(unsigned i = 1; i < threads; i++)
+            workers[i]->thread = std::thread([this, i] { loop(i); });
+    }
+
+    JsonThreadPool::~JsonThreadPool()
     {
-        assert(codepoint <= 0x10FFFF);
-        std::u8string temp;
-        //U+0000~U+007F -> 1 byte: 0xxx xxxx
-        if(codepoint <= 0x007F)
-        {
-            temp.push_back(codepoint & 0x7F);                   //0x7F = 0111 1111
-        }
-        //U+0080~U+07FF-> 2 bytes: 110x xxxx, 10yy yyyy
-        else if (0x0080 <= codepoint && codepoint <= 0x07FF)
-        {
-            temp.push_back(0xC0 | ((codepoint >> 6) & 0x1F));   //0xC0 = 1100 0000, 0x1F = 0001 1111
-            temp.push_back(0x80 | ( codepoint       & 0x3F));   //0x80 = 1000 0000, 0x3F = 0011 1111
-        }
-        //U+0800~U+FFFF-> 3 bytes: 1110 xxxx, 10yy yyyy, 10zz zzzz
-        else if (0x0080 <= codepoint && codepoint <= 0xFFFF)
-        {
-            temp.push_back(0xE0 | ((codepoint >> 12) & 0x0F));   //0xE0 = 1110 0000, 0x0F = 0000 1111
-            temp.push_back(0x80 | ((codepoint >>  6) & 0x3F));   //0x80 = 1000 0000, 0x3F = 0011 1111
-            temp.push_back(0x80 | ( codepoint        & 0x3F));   //0x80 = 1000 0000, 0x3F = 0011 1111
-        }
-        else
-        //U+10000~U+10FFFFF-> 4 bytes: 1111 0xxx, 10yy yyyy, 10zz zzzz, 10mm mmmm
         {
-            temp.push_back(0xF0 | ((codepoint >> 18) & 0x07));   //0xF0 = 1111 0000, 0x07 = 0000 0111
-            temp.push_back(0x80 | ((codepoint >> 12) & 0x3F));   //0x80 = 1000 0000, 0x3F = 0011 1111
-            temp.push_back(0x80 | ((codepoint >>  6) & 0x3F));   //0x80 = 1000 0000, 0x3F = 0011 1111
-            temp.push_back(0x80 | ( codepoint        & 0x3F));   //0x80 = 1000 0000, 0x3F = 0011 1111
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
         }
-        return temp;
+        wake.notify_all();
+        for(auto &w : workers)
+            if(w->thread.joinable())
+                w->thread.join();
     }
 
-    int json_parse_array(JsonContext &c, JsonValue &v)
+    void JsonThreadPool::loop(size_t worker)
     {
-        c.json = c.json.substr(1);
-        std::vector<JsonValue> result;
-        int ret = PARSE_OK;
-        json_parse_whitespace(c);
-        while(ret == PARSE_OK && !c.json.starts_with(u8"]"))
+        size_t seen = 0;
+        while(true)
         {
-            if(c.json.length() == 0)
-                return PARSE_INVAID_ARRAY_END;
-            JsonValue value;
-            ret = json_parse_value(c, value);
-            result.push_back(value);
-            json_parse_whitespace(c);
-
-            //handle ','
-            if(c.json.starts_with(u8","))
             {
-                c.json = c.json.substr(1);
-                json_parse_whitespace(c);
-                if(c.json.starts_with(u8"]"))
-                    return PARSE_EXTRA_ARRAY_SEPARATOR;
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if(stopping)
+                    return;
+                seen = generation;
+                ++busy;
             }
+            work(worker);
+            std::lock_guard<std::mutex> guard(lock);
+            if(--busy == 0)
+                done.notify_all();
         }
-        //handle ']'
-        c.json = c.json.substr(1);
-        if (ret == PARSE_OK)
-        {
-            v.set_type(JSON_ARRAY);
-            v.set_array(result);
-        }
-        return ret;
     }
 
-    int json_parse_object(JsonContext &c, JsonValue &v)
+    void JsonThreadPool::work(size_t worker)
     {
-        //handle '{'
-        c.json = c.json.substr(1);
-        std::map<std::u8string, JsonValue> result;
-        int ret = PARSE_OK;
-        json_parse_whitespace(c);
-        while(ret == PARSE_OK && !c.json.starts_with(u8"}"))
+        while(true)
         {
-            if(c.json.empty())
-                return PARSE_INVAID_OBJECT_END;
-
-            std::u8string key;
-            size_t key_end_pos = 0;
-            if((ret = json_parse_string_raw(c, key, key_end_pos)) != PARSE_OK)
-                return PARSE_INVALID_OBJECT_KEY;
-            c.json = c.json.substr(key_end_pos);
-
-            json_parse_whitespace(c);
-            if(!c.json.starts_with(u8":"))
-                return PARSE_INVALID_OBJECT_SEPARATOR;
-            //handle ':'
-            c.json = c.json.substr(1);
-            json_parse_whitespace(c);
-
-            JsonValue value;
-            if((ret = json_parse_value(c, value)) != PARSE_OK)
-                return PARSE_INVALID_OBJECT_VALUE;
-
-            result.insert({key, value});
-
-            json_parse_whitespace(c);
-            //handle ','
-            if(c.json.starts_with(u8","))
+            //Own tasks from the back, stolen ones from the front of a victim
+            size_t task = 0;
+            bool found = false;
+            for(size_t i = 0; i < workers.size() && !found; i++)
             {
-                c.json = c.json.substr(1);
-                json_parse_whitespace(c);
-                if(c.json.starts_with(u8"}"))
-                    return PARSE_EXTRA_OBJECT_SEPARATOR;
+                Worker &victim = *workers[(worker + i) % workers.size()];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if(victim.tasks.empty())
+                    continue;
+                if(i == 0)
+                {
+                    task = victim.tasks.back();
+                    victim.tasks.pop_back();
+                }
+                else
+                {
+                    task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                }
+                found = true;
             }
+            if(!found)
+                return;
+            (*current)(worker, task);
         }
-        //handle '}'
-        c.json = c.json.substr(1);
-        if (ret == PARSE_OK)
-        {
-            v.set_type(JSON_OBJECT);
-            v.set_object(result);
-        }
-        return ret;
     }
 
-    JsonType JsonValue::get_type()
+    void JsonThreadPool::run(size_t count, const std::function<void(size_t, size_t)> &task)
     {
-        return type;
+        //Written before the tasks are queued, read after they are dequeued
+        current = &task;
+        for(size_t i = 0; i < count; i++)
+        {
+            Worker &w = *workers[i % workers.size()];
+            std::lock_guard<std::mutex> guard(w.lock);
+            w.tasks.push_back(i);
+        }
+        if(count > 1 && workers.size() > 1)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                ++generation;
+            }
+            wake.notify_all();
+        }
+
+        work(0);
+        //Workers may still be finishing stolen tasks
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0; });
     }
 
-    double JsonValue::get_number()
+    JsonBatchParser::JsonBatchParser(unsigned threads) : pool(threads), parsers(pool.size())
     {
-        assert(type == JSON_NUMBER);
-        return number;
     }
 
-    std::u8string& JsonValue::get_string()
+    int JsonBatchParser::parse(std::span<const std::u8string_view> inputs, std::vector<JsonBatchResult> &results,
+                               const JsonParseOptions &o)
     {
-        assert(type == JSON_STRING);
-        return text;
+        results.resize(inputs.size());
+        JsonParseOptions options = o;
+        options.schema_error = nullptr;
+
+        //Coalesce consecutive documents into tasks
+        tasks.clear();
+        for(size_t begin = 0; begin < inputs.size();)
+        {
+            size_t end = begin, bytes = 0;
+            while(end < inputs.size() && (end == begin || bytes + inputs[end].size() <= task_bytes))
+                bytes += inputs[end++].size();
+            tasks.emplace_back(begin, end);
+            begin = end;
+        }
+        pool.run(tasks.size(), [&](size_t worker, size_t task) {
+            for(size_t i = tasks[task].first; i < tasks[task].second; i++)
+            {
+                results[i].error = parsers[worker].parse(inputs[i], results[i].value, options);
+                if(parsed)
+                    parsed(i);
+            }
+        });
+
+        for(auto &r : results)
+            if(r.error != PARSE_OK)
+                return r.error;
+        return PARSE_OK;
     }
 
-    std::vector<JsonValue> &JsonValue::get_array()
+    JsonParallelWriter::JsonParallelWriter(unsigned threads) : pool(threads)
     {
-        assert(type == JSON_ARRAY);
-        return array;
     }
 
-    std::map<std::u8string, JsonValue> &JsonValue::get_object()
+    void JsonParallelWriter::add_task()
     {
-        assert(type == JSON_OBJECT);
-        return object;
+        if(task_count == tasks.size())
+            tasks.emplace_back();
+        Task &t = tasks[task_count++];
+        t.value = nullptr;
+        t.first = t.last = {};
+        t.first_member = t.last_member = {};
+        t.out.clear();
+        if(literals.size() <= task_count)
+            literals.emplace_back();
+        literals[task_count].clear();
     }
 
-    JsonValue &JsonValue::operator=(const double v){
-        type = JSON_NUMBER;
-        number = v;
+    void JsonParallelWriter::plan(JsonValue &v, int depth)
+    {
+        JsonType type = v.get_type();
+        if(type != JSON_ARRAY && type != JSON_OBJECT)
+        {
+            v.write(literals[task_count]);
+            return;
+        }
+        size_t count = type == JSON_ARRAY ? v.get_array().size() : v.get_object().size();
+        //A group has at least one child, so 0 means 1
+        size_t group = std::max<size_t>(min_group, 1);
+        //Keeps the plan small for wide trees without large containers
+        if(count < 2 * group && (depth >= 8 || task_count > 64 * pool.size()))
+        {
+            add_task();
+            tasks[task_count - 1].value = &v;
+            return;
+        }
 
-        text.clear();
-        array.clear();
-        object.clear();
-        return *this;
+        literals[task_count].push_back(type == JSON_ARRAY ? u8'[' : u8'{');
+        if(count >= 2 * group)
+        {
+            size_t groups = std::min(count / group, 4 * pool.size());
+            std::vector<JsonValue>::iterator element;
+            std::map<std::u8string, JsonValue>::iterator member;
+            if(type == JSON_ARRAY)
+                element = v.get_array().begin();
+            else
+                member = v.get_object().begin();
+            for(size_t g = 0; g < groups; g++)
+            {
+                size_t size = count / groups + (g < count % groups);
+                if(g)
+                    literals[task_count].push_back(u8',');
+                add_task();
+                Task &t = tasks[task_count - 1];
+                if(type == JSON_ARRAY)
+                {
+                    t.first = element;
+                    t.last = element += size;
+                }
+                else
+                {
+                    t.first_member = member;
+                    std::advance(member, size);
+                    t.last_member = member;
+                }
+            }
+        }
+        else if(type == JSON_ARRAY)
+        {
+            for(auto &i : v.get_array())
+            {
+                if(&i != &v.get_array().front())
+                    literals[task_count].push_back(u8',');
+                plan(i, depth + 1);
+            }
+        }
+        else
+        {
+            bool first = true;
+            for(auto &i : v.get_object())
+            {
+                if(!first)
+                    literals[task_count].push_back(u8',');
+                first = false;
+                literals[task_count].push_back(u8'"');
+                literals[task_count] += i.first;
+                literals[task_count] += u8"\":";
+                plan(i.second, depth + 1);
+            }
+        }
+        literals[task_count].push_back(type == JSON_ARRAY ? u8']' : u8'}');
     }
-    JsonValue &JsonValue::operator=(const JsonType t) {
-        type = t;
 
-        number = 0.0;
-        text.clear();
-        array.clear();
-        object.clear();
-        return *this;
-    }
-    JsonValue &JsonValue::operator=(const char8_t* str)
+    const std::vector<std::u8string_view> &JsonParallelWriter::to_chunks(JsonValue &v)
     {
-        type = JSON_STRING;
-        text = str;
+        task_count = 0;
+        if(literals.empty())
+            literals.emplace_back();
+        literals[0].clear();
+        plan(v, 0);
 
-        number = 0.0;
-        array.clear();
-        object.clear();
-        return *this;
+        pool.run(task_count, [this](size_t, size_t index) {
+            Task &t = tasks[index];
+            if(t.value)
+                t.value->write(t.out);
+            else if(t.first != t.last)
+                json_write_elements(t.out, t.first, t.last);
+            else
+                json_write_members(t.out, t.first_member, t.last_member);
+        });
+
+        chunks.clear();
+        for(size_t i = 0; i <= task_count; i++)
+        {
+            if(!literals[i].empty())
+                chunks.push_back(literals[i]);
+            if(i < task_count && !tasks[i].out.empty())
+                chunks.push_back(tasks[i].out);
+        }
+        return chunks;
     }
 
-    JsonValue &JsonValue::operator=(const std::u8string_view str)
+    std::u8string JsonParallelWriter::to_string(JsonValue &v)
     {
-        type = JSON_STRING;
-        text = str;
+        size_t size = 0;
+        for(auto chunk : to_chunks(v))
+            size += chunk.size();
+        std::u8string out;
+        out.reserve(size);
+        for(auto chunk : chunks)
+            out += chunk;
+        return out;
+    }
 
-        number = 0.0;
-        array.clear();
-        object.clear();
-        return *this;
+#if __has_include(<sys/uio.h>)
+    std::vector<iovec> json_iovecs(const std::vector<std::u8string_view> &chunks)
+    {
+        std::vector<iovec> result;
+        result.reserve(chunks.size());
+        for(auto chunk : chunks)
+            result.push_back(iovec{const_cast<char8_t *>(chunk.data()), chunk.size()});
+        return result;
     }
-    JsonValue &JsonValue::operator=(const std::vector<JsonValue> &a)
+#endif
+
+    // 64-bit hash of 32 bytes per round in four independent lanes, which the
+    // compiler can keep in vector registers. Not suitable against adversaries.
+    uint64_t json_hash_bytes(std::u8string_view data)
     {
-        type = JSON_ARRAY;
-        array = a;
+        const uint64_t p1 = 0x9E3779B185EBCA87ull, p2 = 0xC2B2AE3D27D4EB4Full, p3 = 0x165667B19E3779F9ull;
+        auto load = [&data](size_t i) {
+            uint64_t v;
+            memcpy(&v, data.data() + i, sizeof(v));
+            return v;
+        };
+        auto round = [&](uint64_t acc, uint64_t v) { return std::rotl(acc + v * p2, 31) * p1; };
 
-        number = 0.0;
-        text.clear();
-        object.clear();
-        return *this;
+        uint64_t h = p3 + data.size();
+        size_t i = 0;
+        if(data.size() >= 32)
+        {
+            uint64_t lanes[4] = {p1 + p2, p2, 0, 0 - p1};
+            for(; i + 32 <= data.size(); i += 32)
+                for(int l = 0; l < 4; l++)
+                    lanes[l] = round(lanes[l], load(i + l * 8));
+            for(int l = 0; l < 4; l++)
+                h = (h ^ round(0, lanes[l])) * p1 + p3;
+        }
+        for(; i + 8 <= data.size(); i += 8)
+            h = std::rotl(h ^ round(0, load(i)), 27) * p1 + p3;
+        for(; i < data.size(); i++)
+            h = std::rotl(h ^ data[i] * p3, 11) * p1;
+        h ^= h >> 33;
+        h *= p2;
+        h ^= h >> 29;
+        h *= p3;
+        return h ^ (h >> 32);
     }
-    JsonValue &JsonValue::operator=(const std::map<std::u8string, JsonValue> &o)
+
+    JsonParseCache::JsonParseCache(size_t budget_bytes) : budget(budget_bytes)
     {
-        type = JSON_OBJECT;
-        object = o;
+    }
 
-        number = 0.0;
-        text.clear();
-        array.clear();
-        return *this;
+    std::list<JsonParseCache::Entry>::iterator JsonParseCache::find(uint64_t hash, std::u8string_view json,
+                                                                      const JsonParseOptions &options)
+    {
+        auto range = by_hash.equal_range(hash);
+        for(auto i = range.first; i != range.second; ++i)
+        {
+            Entry &e = *i->second;
+            if(e.json == json && e.schema == (options.schema ? options.schema->id.value : 0) && e.raw_numbers == options.raw_numbers)
+                return i->second;
+        }
+        return entries.end();
     }
 
-    int inline decode_utf8(int *state, int *codep, int byte);
-    std::u8string codepoint_to_string(int codepoint);
-    std::u8string JsonValue::to_string()
+    int JsonParseCache::parse(std::u8string_view json, JsonSharedValue &v, const JsonParseOptions &options)
     {
-        std::u8string str;
-        switch (type)
+        //Limits and the memory budget apply to every parse, so they bypass the cache
+        if(options.limited())
+            return json_parse(v, json, options);
+        uint64_t hash = json_hash_bytes(json);
         {
-        case JSON_NULL:
-            return u8"null";
-        case JSON_FALSE:
-            return u8"false";
-        case JSON_TRUE:
-            return u8"true";
-        case JSON_NUMBER:
+            std::lock_guard<std::mutex> guard(lock);
+            auto hit = find(hash, json, options);
+            if(hit != entries.end())
+            {
+                ++counters.hits;
+                entries.splice(entries.begin(), entries, hit);
+                v = hit->value;
+                return PARSE_OK;
+            }
+            ++counters.misses;
+        }
+
+        int ret = json_parse(v, json, options);
+        if(ret != PARSE_OK)
+            return ret;
+        size_t bytes = sizeof(Entry) + json.size() + v.memory_usage();
+        if(bytes > budget)
+            return PARSE_OK;
+
+        std::lock_guard<std::mutex> guard(lock);
+        //Another thread may have inserted the same input meanwhile
+        auto existing = find(hash, json, options);
+        if(existing != entries.end())
         {
-            std::string temp = std::to_string(number);
-            return std::u8string(temp.begin(), temp.end());
+            v = existing->value;
+            return PARSE_OK;
         }
-        case JSON_STRING:
+        while(counters.bytes + bytes > budget)
         {
-            str.push_back(u8'\"');
-            int codepoint = 0, state = 0;
-            for (auto s = text.begin(); s != text.end(); ++s)
-            {
-                if(decode_utf8(&state, &codepoint, *s))
-                    continue;
-                switch(codepoint)
+            Entry &last = entries.back();
+            auto range = by_hash.equal_range(last.hash);
+            for(auto i = range.first; i != range.second; ++i)
+                if(&*i->second == &last)
                 {
-                case u8'\\':
-                    str += u8"\\\\";
-                    break;
-                case u8'/':
-                    str += u8"\\/";
-                    break;
-                case u8'\"':
-                    str += u8"\\\"";
-                    break;
-                case u8'\n':
-                    str += u8"\\n";
-                    break;
-                case u8'\b':
-                    str += u8"\\b";
-                    break;
-                case u8'\f':
-                    str += u8"\\f";
-                    break;
-                case u8'\t':
-                    str += u8"\\t";
-                    break;
-                case u8'\r':
-                    str += u8"\\r";
+                    by_hash.erase(i);
                     break;
-                default:
-                    if(codepoint > 0x20 && codepoint < 0x7F)
-                        str.push_back(static_cast<char8_t>(codepoint));
-                    else
-                        str += codepoint_to_string(codepoint);
                 }
-            }
-            str.push_back(u8'\"');
-            break;
-        }
-        case JSON_ARRAY:
-            str.push_back(u8'[');
-            for(auto &i: array)
-            {
-                str += i.to_string();
-                str.push_back(u8',');
-            }
-            str.pop_back();
-            str.push_back(u8']');
-            break;
-        case JSON_OBJECT:
-            str.push_back(u8'{');
-            for(auto &i: object)
-            {
-                str += u8"\"" + i.first + u8"\"";
-                str.push_back(u8':');
-                str += i.second.to_string();
-                str.push_back(u8',');
-            }
-            str.pop_back();
-            str.push_back(u8'}');
-            break;
+            counters.bytes -= last.bytes;
+            --counters.entries;
+            ++counters.evictions;
+            entries.pop_back();
         }
-        return str;
+        entries.push_front(Entry{hash, std::u8string(json), options.schema ? options.schema->id.value : 0, options.raw_numbers, v, bytes});
+        by_hash.emplace(hash, entries.begin());
+        counters.bytes += bytes;
+        ++counters.entries;
+        return PARSE_OK;
     }
 
-    void JsonValue::set_number(double n) { number = n; }
-    void JsonValue::set_type(JsonType t) { type = t; }
-    void JsonValue::set_string(const std::u8string& str) { text = str; }
-    void JsonValue::set_array(const std::vector<JsonValue>& v) { array = v; }
-    void JsonValue::set_object(const std::map<std::u8string, JsonValue> &o) { object = o; }
+    JsonCacheStats JsonParseCache::stats() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return counters;
+    }
+
+    void JsonParseCache::clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.clear();
+        by_hash.clear();
+        counters.bytes = 0;
+        counters.entries = 0;
+    }
 
     // Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
     // See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
@@ -666,17 +4979,15 @@ namespace Json{
     }
     std::u8string codepoint_to_string(int codepoint)
     {
-        std::u8string next;
-        char str[4];
+        //\uXXXX with 4 hex digits, a surrogate pair above U+FFFF
+        auto hex = [](int n) {
+            std::u8string str = u8"\\u";
+            for(int shift = 12; shift >= 0; shift -= 4)
+                str.push_back(u8"0123456789abcdef"[(n >> shift) & 0xF]);
+            return str;
+        };
         if(codepoint > 0xFFFF)
-        {
-            int h = 0xD800 + ((codepoint - 0x10000) >> 10);
-            int l = 0xDC00 + ((codepoint - 0x10000) & 0x3FF);
-            std::to_chars(str, str + 4, l, 16);
-            next = u8"\\u" + std::u8string(str, str + 4);
-            codepoint = h;
-        }
-        std::to_chars(str, str + 4, codepoint, 16);
-        return u8"\\u" + std::u8string(str, str + 4) + next; 
+            return hex(0xD800 + ((codepoint - 0x10000) >> 10)) + hex(0xDC00 + ((codepoint - 0x10000) & 0x3FF));
+        return hex(codepoint);
     }
 }
\ No newline at end of file
@@ -1,9 +1,31 @@
 #include "json.hpp"
+#include <atomic>
+#include <cstdlib>
 #include <map>
+#include <new>
+#include <sstream>
 #include <string>
 #include <string_view>
+#if __has_include(<sys/socket.h>)
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 using namespace Json;
 
+//Counts every allocation, to check the ones a reused parser avoids
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
 static int main_ret = 0;
 static int test_count = 0;
 static int test_pass = 0;
@@ -157,6 +179,9 @@ static void test_parse_error(){
     TEST_ERROR(PARSE_INVALID_VALUE, u8"inf");
     TEST_ERROR(PARSE_INVALID_VALUE, u8"NAN");
     TEST_ERROR(PARSE_INVALID_VALUE, u8"nan");
+    TEST_ERROR(PARSE_NUMBER_TOO_BIG, u8"1e309");
+    TEST_ERROR(PARSE_NUMBER_TOO_BIG, u8"-1e309");
+    TEST_ERROR(PARSE_NUMBER_TOO_BIG, u8"{\"Key\": [1e999]}");
     /* invalid string */
     TEST_ERROR(PARSE_INVALID_STRING_END, u8"\"Text");
     TEST_ERROR(PARSE_INVALID_STRING_CHAR, TEXT(u8"\t"));
@@ -224,6 +249,79 @@ static void test_parse_number() {
     TEST_NUMBER(1.234E-10, u8"1.234E-10");
 }
 
+static void test_parse_raw_number() {
+    JsonValue v;
+    JsonParseOptions options;
+    options.raw_numbers = true;
+    std::u8string_view json = u8"[12345678901234567890,-9007199254740993,1.10,-0,1e400]";
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, json, options));
+    auto &a = v.get_array();
+    EXPECT_EQ_INT(1, a[0].get_uint64() == 12345678901234567890u);
+    EXPECT_EQ_INT(1, a[1].get_int64() == -9007199254740993);
+    EXPECT_EQ_STRING(std::u8string(u8"1.10"), a[2].get_number_text());
+    EXPECT_EQ_DOUBLE(1.1, a[2].get_number());
+    EXPECT_EQ_INT(1, a[3] == JsonValue(0.0));
+    //Numbers are written back verbatim
+    EXPECT_EQ_STRING(std::u8string(json), v.to_string());
+    EXPECT_EQ_STRING(std::u8string(json), JsonSharedValue(v).to_string());
+    EXPECT_EQ_STRING(std::u8string(json), JsonSharedValue(v).to_value().to_string());
+
+    a[2] = 2.5;
+    EXPECT_EQ_STRING(std::u8string(u8"2.5"), a[2].get_number_text());
+    EXPECT_EQ_STRING(std::u8string(u8"2.500000"), a[2].to_string());
+    //set_number() only drops the text of a raw number
+    a[0].set_number(3);
+    EXPECT_EQ_STRING(std::u8string(u8"3.000000"), a[0].to_string());
+    JsonValue text;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(text, u8"\"abc\""));
+    text.set_number(1);
+    EXPECT_EQ_STRING(std::u8string(u8"abc"), text.get_string());
+
+    //Out of range values saturate, fractions are truncated
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, u8"[12345678901234567890,-1,1e400,-1e400,-2.9,9223372036854775807]", options));
+    EXPECT_EQ_INT(1, a[0].get_int64() == INT64_MAX);
+    EXPECT_EQ_INT(1, a[1].get_uint64() == 0 && a[1].get_int64() == -1);
+    EXPECT_EQ_INT(1, a[2].get_uint64() == UINT64_MAX && a[2].get_int64() == INT64_MAX);
+    EXPECT_EQ_INT(1, a[3].get_uint64() == 0 && a[3].get_int64() == INT64_MIN);
+    EXPECT_EQ_INT(1, a[4].get_int64() == -2 && a[4].get_uint64() == 0);
+    EXPECT_EQ_INT(1, a[5].get_int64() == INT64_MAX && a[5].get_uint64() == 9223372036854775807u);
+    JsonValue parsed;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(parsed, u8"[-1e300,18446744073709551616]"));
+    EXPECT_EQ_INT(1, parsed.get_array()[0].get_int64() == INT64_MIN && parsed.get_array()[0].get_uint64() == 0);
+    EXPECT_EQ_INT(1, parsed.get_array()[1].get_uint64() == UINT64_MAX && parsed.get_array()[1].get_int64() == INT64_MAX);
+    EXPECT_EQ_INT(1, JsonValue(NAN).get_int64() == 0 && JsonValue(NAN).get_uint64() == 0);
+
+    //Raw integers compare exactly, beyond the precision of a double
+    JsonValue big, next, zero, huge;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(big, u8"{\"id\":9007199254740992}", options));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(next, u8"{\"id\":9007199254740993}", options));
+    EXPECT_EQ_INT(0, big == next);
+    EXPECT_EQ_INT(0, JsonSharedValue(big) == JsonSharedValue(next));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(next, u8"{\"id\":9007199254740992}", options));
+    EXPECT_EQ_INT(1, big == next);
+    EXPECT_EQ_INT(1, JsonSharedValue(big) == JsonSharedValue(next) && JsonSharedValue(big).hash() == JsonSharedValue(next).hash());
+    EXPECT_EQ_INT(PARSE_OK, json_parse(zero, u8"[-0,0,1.0,1]", options));
+    EXPECT_EQ_INT(1, zero.get_array()[0] == zero.get_array()[1] && zero.get_array()[2] == zero.get_array()[3]);
+    //A raw integer compares exactly with a double too, so that equality is transitive
+    JsonValue rounded(9007199254740992.0);
+    EXPECT_EQ_INT(1, big.get_object()[u8"id"] == rounded && rounded == big.get_object()[u8"id"]);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(next, u8"{\"id\":9007199254740993}", options));
+    EXPECT_EQ_INT(0, next.get_object()[u8"id"] == rounded || rounded == next.get_object()[u8"id"]);
+    EXPECT_EQ_INT(0, JsonSharedValue(next.get_object()[u8"id"]) == JsonSharedValue(rounded));
+    EXPECT_EQ_INT(1, JsonSharedValue(big.get_object()[u8"id"]) == JsonSharedValue(rounded));
+    JsonValue powers, decimal;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(powers, u8"[18446744073709551616,18446744073709551617,-0]", options));
+    EXPECT_EQ_INT(1, powers.get_array()[0] == JsonValue(0x1p64));
+    EXPECT_EQ_INT(0, powers.get_array()[1] == JsonValue(0x1p64));
+    EXPECT_EQ_INT(1, powers.get_array()[2] == JsonValue(0.0) && powers.get_array()[2] == JsonValue(-0.0));
+    //Raw decimals still compare by their double
+    EXPECT_EQ_INT(PARSE_OK, json_parse(decimal, u8"9007199254740993.0", options));
+    EXPECT_EQ_INT(1, decimal == rounded && decimal == big.get_object()[u8"id"]);
+    EXPECT_EQ_INT(0, decimal == next.get_object()[u8"id"]);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(huge, u8"[123456789012345678901234567890,123456789012345678901234567891]", options));
+    EXPECT_EQ_INT(0, huge.get_array()[0] == huge.get_array()[1]);
+}
+
 static void test_parse_string() {
     //Use TEXT() marco add "" automatically
     TEST_STRING(u8"", TEXT(u8""));
@@ -323,17 +421,1154 @@ static void test_to_string() {
     test_string(o, u8"{\"Null\":null,\"Number\":1.000000,\"Text\":\"Text\"}");
 }
 
+static void test_parser_reuse() {
+    JsonParser parser;
+    JsonValue v;
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(u8"{\"Text\": \"This is a long text value.\", \"Array\": [1, 2, 3]}", v));
+    auto text = v.get_object()[u8"Text"].get_string().data();
+    auto array = v.get_object()[u8"Array"].get_array().data();
+
+    //Same shape: the previous allocations are reused
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(u8"{\"Array\": [4, 5], \"Text\": \"Another long text value.\"}", v));
+    EXPECT_EQ_INT(1, text == v.get_object()[u8"Text"].get_string().data());
+    EXPECT_EQ_INT(1, array == v.get_object()[u8"Array"].get_array().data());
+    std::map<std::u8string, JsonValue> expect{{u8"Array", std::vector<JsonValue>{4.0, 5.0}},
+                                              {u8"Text", u8"Another long text value."}};
+    EXPECT_EQ_OBJECT(expect, v.get_object());
+
+    //Different shape: the result is the same as a fresh parse
+    JsonValue fresh;
+    std::u8string_view json = u8"[null, {\"Key\": [\"Text\"]}, 1.5]";
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(json, v));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(fresh, json));
+    EXPECT_EQ_ARRAY(fresh.get_array(), v.get_array());
+
+    EXPECT_EQ_INT(PARSE_INVAID_ARRAY_END, parser.parse(u8"[1, 2", v));
+    EXPECT_EQ_INT(JSON_NULL, v.get_type());
+
+    //Steady state: documents of the same shape allocate nothing
+    std::u8string_view record = u8"{\"Id\": 1, \"Name\": \"A name longer than the inline buffer\","
+                                u8" \"Tags\": [\"a\", \"b\"], \"Nested\": {\"Key\": [1, {}]}}";
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(record, v));
+    size_t before = allocations;
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(record, v));
+    EXPECT_EQ_INT(0, (int)(allocations - before));
+
+    //Members missing from one document are pooled for the next, until shrink()
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(u8"{\"Id\": 1}", v));
+    before = allocations;
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(u8"{\"Id\": 1, \"Tags\": [], \"Name\": null}", v));
+    EXPECT_EQ_INT(0, (int)(allocations - before));
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(u8"{\"Id\": 1}", v));
+    parser.shrink();
+    before = allocations;
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(u8"{\"Id\": 1, \"Tags\": [], \"Name\": null}", v));
+    EXPECT_EQ_INT(1, allocations - before >= 2);
+}
+
+static void test_shared_value() {
+    JsonValue v;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, u8"{\"Config\": {\"Name\": \"Text\", \"Size\": 1}, \"Array\": [null, true]}"));
+    JsonSharedValue root(v), copy = root;
+    EXPECT_EQ_INT(1, root.is_same(copy));
+
+    //Only the path to the modified field is copied
+    copy.modify(u8"Config").set(u8"Size", 2.0);
+    EXPECT_EQ_INT(0, root.is_same(copy));
+    EXPECT_EQ_INT(1, root.find(u8"Array")->is_same(*copy.find(u8"Array")));
+    EXPECT_EQ_INT(0, root.find(u8"Config")->is_same(*copy.find(u8"Config")));
+    EXPECT_EQ_INT(1, (*root.find(u8"Config")->find(u8"Name")).is_same(*copy.find(u8"Config")->find(u8"Name")));
+    EXPECT_EQ_DOUBLE(1.0, root.find(u8"Config")->find(u8"Size")->get_number());
+    EXPECT_EQ_DOUBLE(2.0, copy.find(u8"Config")->find(u8"Size")->get_number());
+
+    //A uniquely owned node is modified in place
+    JsonSharedValue array(JSON_ARRAY);
+    array.push_back(JSON_NULL).push_back(JSON_TRUE);
+    auto storage = &array.get_array();
+    array.push_back(u8"Text");
+    EXPECT_EQ_INT(1, storage == &array.get_array());
+    JsonSharedValue before = array;
+    array.push_back(1.0);
+    EXPECT_EQ_INT(3, (int)before.size());
+    EXPECT_EQ_INT(4, (int)array.size());
+
+    EXPECT_EQ_INT(1, copy.erase(u8"Array"));
+    EXPECT_EQ_INT(2, (int)root.size());
+    EXPECT_EQ_INT(1, (int)copy.size());
+
+    EXPECT_EQ_INT(1, JsonSharedValue(v) == root);
+    EXPECT_EQ_INT(1, root.to_value() == v);
+
+    //Equality does not trust hashes cached before a change through modify()
+    JsonSharedValue edited(v), target(v);
+    JsonSharedValue &size = edited.modify(u8"Config").modify(u8"Size");
+    target.modify(u8"Config").set(u8"Size", 3.0);
+    edited.hash();
+    target.hash();
+    size = 3.0;
+    EXPECT_EQ_INT(1, edited == target);
+    EXPECT_EQ_STRING(v.to_string(), root.to_string());
+
+    //Written by the same code as JsonValue, escapes and raw numbers included
+    JsonParseOptions raw;
+    raw.raw_numbers = true;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, u8"{\"\u00e9\":[\"a\\\"\\n\u4e2d\",1.50,-0,2],\"b\":{}}", raw));
+    std::u8string expect = v.to_string(), actual = JsonSharedValue(v).to_string();
+    EXPECT_EQ_STRING(expect, actual);
+    actual.clear();
+    JsonSharedValue().write(actual);
+    EXPECT_EQ_STRING(std::u8string(u8"null"), actual);
+}
+
+static void test_schema() {
+    JsonValue schema_json, v;
+    JsonSchema schema;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(schema_json,
+        u8"{\"type\": \"object\", \"required\": [\"Id\"], \"additionalProperties\": false,"
+        u8" \"properties\": {"
+        u8"  \"Id\": {\"type\": \"integer\", \"minimum\": 1},"
+        u8"  \"Name\": {\"type\": \"string\", \"maxLength\": 4},"
+        u8"  \"Tags\": {\"type\": \"array\", \"items\": {\"enum\": [\"a\", \"b\"]}}}}"));
+    EXPECT_EQ_INT(PARSE_OK, json_compile_schema(schema, schema_json));
+
+    JsonSchemaError error;
+    JsonParseOptions options;
+    options.schema = &schema;
+    options.schema_error = &error;
+    auto test_schema = [&](int expect, std::u8string_view json, std::u8string_view path, size_t offset) {
+        EXPECT_EQ_INT(expect, json_parse(v, json, options));
+        if(expect != PARSE_SCHEMA_VIOLATION)
+            return;
+        EXPECT_EQ_STRING(path, error.path);
+        EXPECT_EQ_INT((int)offset, (int)error.offset);
+    };
+    test_schema(PARSE_OK, u8"{\"Id\": 1, \"Name\": \"中文\", \"Tags\": [\"a\", \"b\"]}", u8"", 0);
+    test_schema(PARSE_SCHEMA_VIOLATION, u8"[]", u8"", 0);
+    test_schema(PARSE_SCHEMA_VIOLATION, u8"{\"Name\": \"Text\"}", u8"", 0);
+    test_schema(PARSE_SCHEMA_VIOLATION, u8"{\"Id\": 1.5}", u8"/Id", 7);
+    test_schema(PARSE_SCHEMA_VIOLATION, u8"{\"Id\": 0}", u8"/Id", 7);
+    test_schema(PARSE_SCHEMA_VIOLATION, u8"{\"Id\": 1, \"Name\": \"Texts\"}", u8"/Name", 18);
+    test_schema(PARSE_SCHEMA_VIOLATION, u8"{\"Id\": 1, \"Tags\": [\"a\", \"c\"]}", u8"/Tags/1", 24);
+    test_schema(PARSE_SCHEMA_VIOLATION, u8"{\"Id\": 1, \"Other/Key\": null}", u8"/Other~1Key", 10);
+    EXPECT_EQ_INT(JSON_NULL, v.get_type());
+    //Syntax errors are still reported as such
+    test_schema(PARSE_INVALID_OBJECT_VALUE, u8"{\"Id\": nul}", u8"", 0);
+
+    //Standalone validation of an existing value
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, u8"{\"Id\": 2, \"Tags\": [\"b\", \"x\"]}"));
+    EXPECT_EQ_INT(PARSE_SCHEMA_VIOLATION, json_validate(schema, v, &error));
+    EXPECT_EQ_STRING(std::u8string(u8"/Tags/1"), error.path);
+    v.get_object()[u8"Tags"].get_array().pop_back();
+    EXPECT_EQ_INT(PARSE_OK, json_validate(schema, v));
+
+    EXPECT_EQ_INT(PARSE_OK, json_parse(schema_json, u8"{\"type\": \"text\"}"));
+    EXPECT_EQ_INT(PARSE_INVALID_SCHEMA, json_compile_schema(schema, schema_json));
+}
+
+static void test_events() {
+    std::u8string types;
+    for(auto &e: json_events(u8"{\"Key\": [1.5, \"Text\", true], \"Null\": null}"))
+    {
+        types += u8"nftNSK[]{}?!"[e.type];
+        if(e.type == JSON_EVENT_NUMBER)
+            EXPECT_EQ_STRING(std::u8string(u8"1.5"), e.text);
+        if(e.type == JSON_EVENT_STRING)
+            EXPECT_EQ_STRING(std::u8string(u8"Text"), e.text);
+    }
+    EXPECT_EQ_STRING(std::u8string(u8"{K[NSt]Kn}"), types);
+
+    //Feed one byte at a time, the result must match json_parse()
+    auto test_chunked = [](std::u8string_view json) {
+        JsonValue expect, actual;
+        int expect_ret = json_parse(expect, json), actual_ret = PARSE_OK;
+        JsonInput in;
+        JsonValueBuilder builder(actual);
+        size_t fed = 0;
+        for(auto &e: json_events(in))
+        {
+            if(e.type == JSON_EVENT_NEED_MORE)
+            {
+                if(fed == json.length())
+                    in.close();
+                else
+                    in.feed(json.substr(fed++, 1));
+            }
+            else if(e.type == JSON_EVENT_ERROR)
+                actual_ret = e.error;
+            else
+                builder.add(e);
+        }
+        EXPECT_EQ_INT(expect_ret, actual_ret);
+        if(expect_ret == PARSE_OK)
+            EXPECT_EQ_STRING(expect.to_string(), actual.to_string());
+    };
+    test_chunked(u8"{\"Key\": [1.5e-3, \"\\u4e2d\\ud83d\\ude00\\\\\", -0, {}], \"Null\": null, \"Empty\": []}");
+    test_chunked(u8" [ true , false ] ");
+    //The first occurrence of a key wins, nested repeated keys included
+    const char *duplicates = "{\"a\":1,\"a\":[{\"x\":1,\"x\":2,\"y\":3}],\"b\":{\"c\":{\"d\":[]},\"c\":[[{\"e\":1}]],\"f\":2}}";
+    test_chunked(json_as_u8(duplicates, strlen(duplicates)));
+    JsonValue from_stream, expect_value;
+    std::istringstream duplicates_stream(duplicates);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(from_stream, duplicates_stream, JsonParseOptions(), 2));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(expect_value, duplicates));
+    EXPECT_EQ_INT(1, from_stream == expect_value);
+    std::u8string duplicates_string = from_stream.to_string();
+    EXPECT_EQ_STRING(std::u8string(u8"{\"a\":1.000000,\"b\":{\"c\":{\"d\":[]},\"f\":2.000000}}"), duplicates_string);
+    for(auto json: {u8"", u8"tru", u8"null a", u8"+1", u8"1.", u8"1.1.23", u8"\"Text", u8"\"\\u01Gh\"",
+                    u8"[1, 2", u8"[1, 2,]", u8"{\"Key\": null", u8"{\"Key: null}", u8"{\"Key\"| null}",
+                    u8"{\"Key\": nul}", u8"{\"Key\": null,}", u8"{\"Key\": [nul]}"})
+        test_chunked(json);
+
+    //Several top-level values
+    JsonInput in{u8"1 [2] {\"Key\": 3}", true};
+    JsonValue v;
+    JsonValueBuilder builder(v);
+    std::u8string values;
+    for(auto &e: json_events(in, true))
+        if(builder.add(e))
+            values += v.to_string() + u8";";
+    EXPECT_EQ_STRING(std::u8string(u8"1.000000;[2.000000];{\"Key\":3.000000};"), values);
+}
+
+#if __has_include(<sys/socket.h>)
+// Non-blocking socket read, suspends until the test loop resumes it.
+struct SocketSource
+{
+    int fd;
+    std::coroutine_handle<> waiting;
+
+    struct Read
+    {
+        SocketSource &source;
+        char8_t *buffer;
+        size_t size;
+        ssize_t result = -1;
+        bool await_ready() { return (result = ::read(source.fd, buffer, size)) >= 0; }
+        void await_suspend(std::coroutine_handle<> h) { source.waiting = h; }
+        size_t await_resume()
+        {
+            if(result < 0)
+                result = ::read(source.fd, buffer, size);
+            return result > 0 ? result : 0;
+        }
+    };
+    Read read(char8_t *buffer, size_t size) { return Read{*this, buffer, size}; }
+};
+
+static void test_parse_async() {
+    //Two slow connections parsed on one thread
+    std::u8string_view json[2] = {u8"{\"Key\": [1, 2, \"Text\"]}", u8"[null, {\"Key\": false}]"};
+    int fds[2][2];
+    SocketSource sources[2];
+    JsonValue values[2];
+    std::vector<JsonTask<int>> tasks;
+    for(int i = 0; i < 2; i++)
+    {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]);
+        fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+        sources[i].fd = fds[i][0];
+        tasks.push_back(json_parse_async(sources[i], values[i]));
+        tasks[i].start();
+    }
+    for(size_t offset = 0; offset < 32; offset += 3)
+    {
+        for(int i = 0; i < 2; i++)
+        {
+            if(offset < json[i].length())
+                write(fds[i][1], json[i].data() + offset, std::min<size_t>(3, json[i].length() - offset));
+            else if(fds[i][1] >= 0)
+            {
+                close(fds[i][1]);
+                fds[i][1] = -1;
+            }
+            if(!tasks[i].done())
+                std::exchange(sources[i].waiting, nullptr).resume();
+        }
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        JsonValue expect;
+        json_parse(expect, json[i]);
+        EXPECT_EQ_INT(1, tasks[i].done());
+        EXPECT_EQ_INT(PARSE_OK, tasks[i].get());
+        EXPECT_EQ_STRING(expect.to_string(), values[i].to_string());
+        close(fds[i][0]);
+    }
+}
+#endif
+
+constexpr auto static_config = u8"{\"Name\": \"\\u4e2d\\ud83d\\ude00\", \"Port\": 8080, \"Ratio\": -1.25e-2,"
+                                u8" \"Tags\": [null, true, {}], \"Id\": 9007199254740993}"_json;
+static_assert(static_config.root().get_type() == JSON_OBJECT);
+static_assert(static_config.root().size() == 5);
+static_assert(static_config.root()[u8"Port"].get_number() == 8080);
+static_assert(static_config.root()[u8"Ratio"].get_number() == -1.25e-2);
+static_assert(static_config.root()[u8"Name"].get_string() == u8"中😀");
+static_assert(static_config.root()[u8"Tags"][1].get_type() == JSON_TRUE);
+static_assert(static_config.root()[u8"Tags"][2].size() == 0);
+static_assert(static_config.root()[u8"Id"].get_number_text() == u8"9007199254740993");
+static_assert(!static_config.root().contains(u8"Host"));
+//Storage is sized to the 9 values and 54 characters of strings, keys and numbers
+static_assert(sizeof(static_config) == (9 * sizeof(JsonStaticNode) + 54 + alignof(JsonStaticNode) - 1) / alignof(JsonStaticNode) * alignof(JsonStaticNode));
+
+template <size_t N>
+constexpr int STATIC_PARSE(const char8_t (&json)[N])
+{
+    JsonStaticDocument<N, N> document;
+    return document.parse(std::u8string_view(json, N - 1));
+}
+static_assert(STATIC_PARSE(u8"") == PARSE_EXPECT_VALUE);
+static_assert(STATIC_PARSE(u8"tru") == PARSE_INVALID_VALUE);
+static_assert(STATIC_PARSE(u8"null a") == PARSE_ROOT_NOT_SINGULAR);
+static_assert(STATIC_PARSE(u8"1.") == PARSE_INVALID_VALUE);
+static_assert(STATIC_PARSE(u8"\"\\ud83d|ude00\"") == PARSE_INVALID_UNICODE_SURROGATE);
+static_assert(STATIC_PARSE(u8"[1, 2") == PARSE_INVAID_ARRAY_END);
+static_assert(STATIC_PARSE(u8"[1, 2,]") == PARSE_EXTRA_ARRAY_SEPARATOR);
+static_assert(STATIC_PARSE(u8"{\"Key: null}") == PARSE_INVALID_OBJECT_KEY);
+static_assert(STATIC_PARSE(u8"{\"Key\"| null}") == PARSE_INVALID_OBJECT_SEPARATOR);
+static_assert(STATIC_PARSE(u8"{\"Key\": nul}") == PARSE_INVALID_OBJECT_VALUE);
+static_assert(STATIC_PARSE(u8"{\"Key\": null,}") == PARSE_EXTRA_OBJECT_SEPARATOR);
+
+template <size_t Nodes, size_t Chars, size_t N>
+constexpr int STATIC_PARSE_INTO(const char8_t (&json)[N])
+{
+    JsonStaticDocument<Nodes, Chars> document;
+    return document.parse(std::u8string_view(json, N - 1));
+}
+static_assert(STATIC_PARSE_INTO<2, 2>(u8"[1,2,3,4,5,6,7,8,9,10,11]") == PARSE_LIMIT_EXCEEDED);
+static_assert(STATIC_PARSE_INTO<12, 2>(u8"[1,2,3,4,5,6,7,8,9,10,11]") == PARSE_LIMIT_EXCEEDED);
+static_assert(STATIC_PARSE_INTO<1, 2>(u8"\"abc\"") == PARSE_LIMIT_EXCEEDED);
+static_assert(STATIC_PARSE_INTO<2, 8>(u8"{\"a\":[1]}") == PARSE_LIMIT_EXCEEDED);
+static_assert(STATIC_PARSE_INTO<12, 13>(u8"[1,2,3,4,5,6,7,8,9,10,11]") == PARSE_OK);
+
+static_assert(!std::is_copy_constructible_v<JsonTranscoder> && !std::is_move_constructible_v<JsonTranscoder>);
+static_assert(!std::is_copy_assignable_v<JsonTranscoder> && !std::is_move_assignable_v<JsonTranscoder>);
+
+static void test_transcode() {
+    std::u8string_view json = u8" { \"a\" : [ 1.50 , true , null , { } , [ ] ] , \"b\" : \"\u00e9\" } ";
+    std::u8string out;
+    EXPECT_EQ_INT(PARSE_OK, json_transcode(json, out));
+    EXPECT_EQ_STRING(std::u8string(u8"{\"a\":[1.50,true,null,{},[]],\"b\":\"\\u00e9\"}"), out);
+
+    JsonFormat format;
+    format.indent = 2;
+    format.ascii = false;
+    out.clear();
+    EXPECT_EQ_INT(PARSE_OK, json_transcode(json, out, format));
+    EXPECT_EQ_STRING(std::u8string(u8"{\n  \"a\": [\n    1.50,\n    true,\n    null,\n    {},\n    []\n  ],\n  \"b\": \"\u00e9\"\n}"), out);
+
+    //Feeding one byte at a time gives the same output
+    std::u8string chunked;
+    JsonTranscoder transcoder(format);
+    for(size_t i = 0; i < json.size(); i++)
+        EXPECT_EQ_INT(PARSE_OK, transcoder.feed(json.substr(i, 1), chunked));
+    EXPECT_EQ_INT(PARSE_OK, transcoder.finish(chunked));
+    EXPECT_EQ_STRING(out, chunked);
+
+    JsonValue v;
+    out.clear();
+    EXPECT_EQ_INT(json_parse(v, u8"[1,{\"a\":2"), json_transcode(u8"[1,{\"a\":2", out));
+    out.clear();
+    EXPECT_EQ_INT(PARSE_ROOT_NOT_SINGULAR, json_transcode(u8"1 2", out));
+}
+
+static void test_index() {
+    JsonValue v;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, u8"[{\"id\":3,\"user\":{\"name\":\"c\"}},{\"id\":-1,\"user\":{\"name\":\"a\"}},"
+                                       u8"{\"user\":{}},{\"id\":3.0,\"user\":{\"name\":\"b\"}},{\"id\":[]}]"));
+    JsonIndex by_id(v, u8"/id");
+    EXPECT_EQ_INT(1, by_id.find(-1.0) == &v.get_array()[1]);
+    EXPECT_EQ_INT(1, by_id.find(4.0) == nullptr);
+    EXPECT_EQ_INT(2, (int)by_id.find_all(3.0).size());
+    EXPECT_EQ_INT(1, by_id.find(u8"3") == nullptr);
+
+    JsonIndex by_name(v, u8"/user/name", JSON_INDEX_SORTED);
+    auto names = by_name.range(u8"a", u8"b");
+    EXPECT_EQ_INT(2, (int)names.size());
+    EXPECT_EQ_INT(1, names[0] == &v.get_array()[1] && names[1] == &v.get_array()[3]);
+    JsonIndex sorted_id(v, u8"/id", JSON_INDEX_SORTED);
+    auto ids = sorted_id.range(-10.0, 0.0);
+    EXPECT_EQ_INT(1, ids.size() == 1 && ids[0] == &v.get_array()[1]);
+
+    //Mutations through the index keep it up to date
+    JsonValue record;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(record, u8"{\"id\":7}"));
+    by_id.push_back(record);
+    EXPECT_EQ_INT(1, by_id.find(7.0) == &v.get_array()[5]);
+    by_id.erase(1);
+    EXPECT_EQ_INT(1, by_id.find(-1.0) == nullptr);
+    EXPECT_EQ_INT(1, by_id.find(7.0) == &v.get_array()[4]);
+    by_id.set(0, record);
+    EXPECT_EQ_INT(1, (int)by_id.find_all(3.0).size());
+    EXPECT_EQ_INT(2, (int)by_id.find_all(7.0).size());
+
+    //Random mutations agree with a scan of the array
+    for(JsonIndexType type : {JSON_INDEX_HASH, JSON_INDEX_SORTED})
+    {
+        JsonValue records(JSON_ARRAY);
+        JsonIndex index(records, u8"/k", type);
+        uint32_t state = 12345;
+        auto next = [&state] { return (state = state * 1103515245 + 12345) >> 16; };
+        bool agree = true;
+        for(int i = 0; i < 3000; i++)
+        {
+            JsonValue r;
+            json_parse(r, u8"{\"k\":0}");
+            r.get_object()[u8"k"] = double(next() % 8);
+            size_t n = records.get_array().size();
+            if(n == 0 || next() % 3 == 0)
+                index.push_back(r);
+            else if(next() % 2)
+                index.erase(next() % n);
+            else
+                index.set(next() % n, r);
+            double k = double(next() % 8);
+            std::vector<JsonValue *> expect;
+            for(auto &record : records.get_array())
+                if(record.get_object()[u8"k"].get_number() == k)
+                    expect.push_back(&record);
+            std::vector<JsonValue *> actual = index.find_all(k);
+            std::sort(actual.begin(), actual.end());
+            JsonValue *first = index.find(k);
+            agree = agree && actual == expect && (first ? std::binary_search(expect.begin(), expect.end(), first) : expect.empty());
+        }
+        EXPECT_EQ_INT(1, agree);
+        EXPECT_EQ_INT(0, index.stale());
+    }
+
+    //Raw integers beyond 2^53 get distinct keys, in numeric order
+    JsonParseOptions raw;
+    raw.raw_numbers = true;
+    JsonValue big;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(big, u8"[{\"id\":9007199254740993},{\"id\":9007199254740992},{\"id\":-9007199254740993},"
+                                         u8"{\"id\":18446744073709551615},{\"id\":9007199254740994},{\"id\":18446744073709551614}]", raw));
+    for(JsonIndexType type : {JSON_INDEX_HASH, JSON_INDEX_SORTED})
+    {
+        JsonIndex index(big, u8"/id", type);
+        bool found = true;
+        for(auto &record : big.get_array())
+            found = found && index.find(record.get_object()[u8"id"]) == &record && index.find_all(record.get_object()[u8"id"]).size() == 1;
+        EXPECT_EQ_INT(1, found);
+    }
+    JsonIndex big_sorted(big, u8"/id", JSON_INDEX_SORTED);
+    JsonValue low, high;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(low, u8"-9007199254740993", raw));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(high, u8"18446744073709551615", raw));
+    auto order = big_sorted.range(low, high);
+    auto &records = big.get_array();
+    std::vector<JsonValue *> expect_order = {&records[2], &records[1], &records[0], &records[4], &records[5], &records[3]};
+    EXPECT_EQ_INT(1, order == expect_order);
+    EXPECT_EQ_INT(2, (int)big_sorted.range(low, 9007199254740992.0).size());
+
+    //Changes made directly to the array invalidate the index
+    v.get_array().clear();
+    EXPECT_EQ_INT(1, by_id.stale());
+    EXPECT_EQ_INT(1, by_id.find(7.0) == nullptr);
+    EXPECT_EQ_INT(0, by_id.stale());
+
+    JsonValue *id = json_find_pointer(record, u8"/id");
+    EXPECT_EQ_INT(1, id && id->get_number() == 7.0);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, u8"{\"a/b\":[0,{\"~\":1}]}"));
+    EXPECT_EQ_INT(1, json_find_pointer(v, u8"/a~1b/1/~0")->get_number() == 1.0);
+    EXPECT_EQ_INT(1, json_find_pointer(v, u8"/a~1b/01") == nullptr);
+    EXPECT_EQ_INT(1, json_find_pointer(v, u8"") == &v);
+}
+
+static void test_batch() {
+    std::vector<std::u8string> bodies;
+    for(int i = 0; i < 500; i++)
+        bodies.push_back(i % 97 == 5 ? u8"{\"id\":}" : u8"{\"id\":" + std::u8string(1, u8'0' + i % 10) + u8",\"tags\":[\"a\"]}");
+    std::vector<std::u8string_view> inputs(bodies.begin(), bodies.end());
+    for(unsigned threads : {1u, 4u})
+    {
+        JsonBatchParser batch(threads);
+        batch.task_bytes = 64;
+        std::vector<JsonBatchResult> results;
+        //The second round parses into the results of the first
+        for(int round = 0; round < 2; round++)
+        {
+            EXPECT_EQ_INT(PARSE_INVALID_OBJECT_VALUE, batch.parse(inputs, results));
+            EXPECT_EQ_INT(500, (int)results.size());
+            bool same = true;
+            for(size_t i = 0; i < inputs.size(); i++)
+            {
+                JsonValue v;
+                same = same && json_parse(v, inputs[i]) == results[i].error && (results[i].error || v == results[i].value);
+            }
+            EXPECT_EQ_INT(1, same);
+        }
+        EXPECT_EQ_INT(PARSE_OK, batch.parse(std::span(inputs).first(5), results));
+        EXPECT_EQ_INT(5, (int)results.size());
+
+        //Each document is reported once, after its result is stored
+        std::vector<std::atomic<int>> reported(inputs.size());
+        std::atomic<bool> stored{true};
+        batch.parsed = [&](size_t i) {
+            reported[i]++;
+            if(results[i].error == PARSE_OK && results[i].value.get_type() != JSON_OBJECT)
+                stored = false;
+        };
+        batch.parse(inputs, results);
+        EXPECT_EQ_INT(1, std::all_of(reported.begin(), reported.end(), [](auto &n) { return n == 1; }) && stored);
+    }
+}
+
+static void test_parse_cache() {
+    std::u8string text(100, u8'x');
+    bool distinct = true;
+    for(size_t i = 1; i <= text.size(); i++)
+        distinct = distinct && json_hash_bytes(std::u8string_view(text).substr(0, i)) != json_hash_bytes(std::u8string_view(text).substr(0, i - 1));
+    EXPECT_EQ_INT(1, distinct);
+
+    JsonParseCache cache(4096);
+    std::u8string a = u8"{\"Name\":\"a\",\"Ports\":[80,443]}", b = u8"[1,2,3]";
+    JsonSharedValue v1, v2, v3;
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(a, v1));
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(std::u8string(a), v2));
+    EXPECT_EQ_INT(1, v1.is_same(v2));
+    EXPECT_EQ_INT(443, (int)(*v2.find(u8"Ports"))[1].get_number());
+    //Other options give another entry
+    JsonParseOptions options;
+    options.raw_numbers = true;
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(a, v3, options));
+    EXPECT_EQ_INT(0, v1.is_same(v3));
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, cache.parse(u8"[nul]", v3));
+    EXPECT_EQ_INT(JSON_NULL, v3.get_type());
+    JsonCacheStats stats = cache.stats();
+    EXPECT_EQ_INT(1, (int)stats.hits);
+    EXPECT_EQ_INT(3, (int)stats.misses);
+    EXPECT_EQ_INT(2, (int)stats.entries);
+
+    //Misses are built directly as shared values, matching the DOM
+    std::u8string c = u8"{\"a\":[1,{\"b\":null},\"x\"],\"a\":2,\"c\":1e2,\"d\":{}}";
+    JsonValue dom;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(dom, c, options));
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(c, v3, options));
+    std::u8string expect_string = dom.to_string(), actual_string = v3.to_string();
+    EXPECT_EQ_STRING(expect_string, actual_string);
+    EXPECT_EQ_INT(1, dom == v3.to_value());
+    options.max_values = 3;
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(v3, c, options));
+    EXPECT_EQ_INT(JSON_NULL, v3.get_type());
+    //Limits apply to cached inputs too, without touching the cache
+    size_t hits = cache.stats().hits;
+    int limited = cache.parse(c, v3, options);
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, limited);
+    EXPECT_EQ_INT(JSON_NULL, v3.get_type());
+    EXPECT_EQ_INT(1, cache.stats().hits == hits);
+    options.max_values = SIZE_MAX;
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(c, v3, options));
+    EXPECT_EQ_INT(1, cache.stats().hits == hits + 1);
+
+
+    //Filling the budget evicts the least recently used entry
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(a, v2));
+    for(int i = 0; i < 100 && cache.stats().evictions == 0; i++)
+        EXPECT_EQ_INT(PARSE_OK, cache.parse(u8"[" + std::u8string(1, u8'0' + i % 10) + u8"," + std::u8string(i, u8' ') + u8"1]", v3));
+    stats = cache.stats();
+    EXPECT_EQ_INT(1, stats.evictions > 0 && stats.bytes <= 4096);
+    EXPECT_EQ_INT(1, v1.is_same(v2));
+    cache.clear();
+    EXPECT_EQ_INT(0, (int)cache.stats().entries);
+
+    //A recompiled schema is a new key, even at the same address
+    JsonValue schema_json;
+    JsonSchema schema;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(schema_json, u8"{\"type\": \"array\"}"));
+    EXPECT_EQ_INT(PARSE_OK, json_compile_schema(schema, schema_json));
+    options.schema = &schema;
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(b, v3, options));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(schema_json, u8"{\"type\": \"object\"}"));
+    EXPECT_EQ_INT(PARSE_OK, json_compile_schema(schema, schema_json));
+    EXPECT_EQ_INT(PARSE_SCHEMA_VIOLATION, cache.parse(b, v3, options));
+    options.schema = nullptr;
+
+    //Concurrent lookups all get the same value once it is cached
+    EXPECT_EQ_INT(PARSE_OK, cache.parse(b, v1));
+    std::atomic<int> same = 0;
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++)
+        threads.emplace_back([&] {
+            for(int i = 0; i < 100; i++)
+            {
+                JsonSharedValue v;
+                if(cache.parse(b, v) == PARSE_OK && v.is_same(v1))
+                    ++same;
+            }
+        });
+    for(auto &t : threads)
+        t.join();
+    EXPECT_EQ_INT(400, same.load());
+}
+
+static void test_parse_bytes() {
+    JsonValue v, expect;
+    std::string text = "{\"a\":[1,\"x\"]}";
+    EXPECT_EQ_INT(PARSE_OK, json_parse(expect, u8"{\"a\":[1,\"x\"]}"));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, text));
+    EXPECT_EQ_INT(1, v == expect);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, text.c_str()));
+    EXPECT_EQ_INT(1, v == expect);
+    std::vector<unsigned char> buffer(text.begin(), text.end());
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, buffer));
+    EXPECT_EQ_INT(1, v == expect);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, std::as_bytes(std::span(text))));
+    EXPECT_EQ_INT(1, v == expect);
+    JsonParser parser;
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(std::string_view(text), v));
+    EXPECT_EQ_INT(1, v == expect);
+    //The input is read in place
+    EXPECT_EQ_INT(1, json_as_u8(text).data() == (const char8_t *)text.data());
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, json_parse(v, "nul"));
+    //Buffers have no terminating NUL, truncated ones end in the middle of a value
+    std::vector<char> truncated = {'{', '"', 'a', '"', ':'};
+    EXPECT_EQ_INT(PARSE_INVALID_OBJECT_VALUE, json_parse(v, truncated));
+    EXPECT_EQ_INT(PARSE_INVAID_ARRAY_END, json_parse(v, std::vector<char>{'[', '1', ','}));
+    EXPECT_EQ_INT(PARSE_EXPECT_VALUE, json_parse(v, std::vector<char>{' '}));
+
+    //Streams are read through a window smaller than the tokens
+    std::istringstream stream(" " + text + " ");
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, stream, JsonParseOptions(), 3));
+    EXPECT_EQ_INT(1, v == expect);
+    std::istringstream extra(text + "1");
+    EXPECT_EQ_INT(PARSE_ROOT_NOT_SINGULAR, json_parse(v, extra));
+    EXPECT_EQ_INT(JSON_NULL, v.get_type());
+
+    FILE *file = tmpfile();
+    if(file)
+    {
+        fwrite(text.data(), 1, text.size(), file);
+        rewind(file);
+        JsonValue schema_json;
+        JsonSchema schema;
+        json_parse(schema_json, "{\"properties\":{\"a\":{\"items\":{\"type\":\"number\"}}}}");
+        EXPECT_EQ_INT(PARSE_OK, json_compile_schema(schema, schema_json));
+        JsonParseOptions options;
+        JsonSchemaError error;
+        options.schema = &schema;
+        options.schema_error = &error;
+        EXPECT_EQ_INT(PARSE_SCHEMA_VIOLATION, json_parse(v, file, options, 4));
+        EXPECT_EQ_STRING(std::u8string(u8"/a/1"), error.path);
+        rewind(file);
+        EXPECT_EQ_INT(PARSE_OK, json_parse(v, file));
+        EXPECT_EQ_INT(1, v == expect);
+        fclose(file);
+    }
+}
+
+static void test_parallel_writer() {
+    std::u8string json = u8"{\"empty\":[],\"none\":{},\"items\":[";
+    for(int i = 0; i < 1000; i++)
+        json += (i ? u8"," : u8"") + std::u8string(u8"{\"id\":1.5,\"name\":\"a\\n\\u00e9\",\"tags\":[true,false,null,[]]}");
+    json += u8"],\"wide\":{";
+    for(int i = 0; i < 300; i++)
+        json += (i ? u8",\"k" : u8"\"k") + std::u8string(1, u8'a' + i % 26) + std::u8string(i / 26, u8'x') + u8"\":[1,{}]";
+    json += u8"},\"n\":12345678901234567890}";
+    JsonValue v;
+    JsonParseOptions options;
+    options.raw_numbers = true;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, json, options));
+    std::u8string serial = v.to_string();
+    for(unsigned threads : {1u, 4u})
+        for(size_t group : {0, 1, 4, 64})
+        {
+            JsonParallelWriter writer(threads);
+            writer.min_group = group;
+            EXPECT_EQ_INT(1, writer.to_string(v) == serial);
+            std::u8string joined;
+            for(auto chunk : writer.to_chunks(v))
+                joined += chunk;
+            EXPECT_EQ_INT(1, joined == serial);
+        }
+    JsonParallelWriter writer(2);
+    JsonValue scalar(JSON_TRUE);
+    EXPECT_EQ_STRING(std::u8string(u8"true"), writer.to_string(scalar));
+#if __has_include(<sys/uio.h>)
+    size_t total = 0;
+    for(auto &io : json_iovecs(writer.to_chunks(v)))
+        total += io.iov_len;
+    EXPECT_EQ_INT((int)serial.size(), (int)total);
+#endif
+}
+
+static void test_dedup() {
+    std::u8string json = u8"{\"b\":1,\"items\":[";
+    for(int i = 0; i < 50; i++)
+        json += (i ? u8"," : u8"") + std::u8string(u8"{\"status\":\"active\",\"tags\":[\"x\",\"y\"],\"n\":1.0}");
+    json += u8"],\"a\":1,\"b\":2,\"raw\":[1.0,1,-0,0]}";
+    JsonValue v;
+    JsonParseOptions options;
+    options.raw_numbers = true;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, json, options));
+    JsonSharedValue root(v);
+    size_t before = root.memory_usage();
+    size_t saved = json_dedup(root);
+    EXPECT_EQ_INT(1, saved > before * 3 / 4);
+    EXPECT_EQ_INT(1, root == JsonSharedValue(v));
+    EXPECT_EQ_STRING(v.to_string(), root.to_string());
+    const JsonSharedValue &items = *root.find(u8"items");
+    EXPECT_EQ_INT(1, items[0].is_same(items[49]));
+    //Raw numbers with other text stay apart, but compare and hash equal
+    const JsonSharedValue &raw = *root.find(u8"raw");
+    EXPECT_EQ_INT(0, raw[0].is_same(raw[1]));
+    EXPECT_EQ_INT(1, raw[0] == raw[1] && raw[0].hash() == raw[1].hash());
+    EXPECT_EQ_INT(1, raw[2].hash() == raw[3].hash());
+    EXPECT_EQ_INT(1, root.find(u8"a")->is_same(*root.find(u8"b")));
+    EXPECT_EQ_INT(1, root.hash() == JsonSharedValue(v).hash());
+    EXPECT_EQ_INT(0, root.hash() == items.hash());
+
+    //Shared nodes are still copied on write
+    JsonSharedValue copy = root;
+    copy.modify(u8"items").modify(size_t(0)).set(u8"status", u8"done");
+    EXPECT_EQ_INT(0, copy == root);
+    EXPECT_EQ_STRING(std::u8string(u8"active"), (*root.find(u8"items"))[0].find(u8"status")->get_string());
+    EXPECT_EQ_STRING(std::u8string(u8"active"), (*copy.find(u8"items"))[1].find(u8"status")->get_string());
+
+    //Interning while parsing gives the same value, shared across documents
+    JsonInterner interner;
+    JsonSharedValue parsed, second;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(parsed, json, interner, true));
+    EXPECT_EQ_STRING(v.to_string(), parsed.to_string());
+    EXPECT_EQ_INT(1, (*parsed.find(u8"items"))[0].is_same((*parsed.find(u8"items"))[1]));
+    EXPECT_EQ_INT(1, interner.bytes_saved() > 0);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(second, json, interner, true));
+    EXPECT_EQ_INT(1, parsed.is_same(second));
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, json_parse(second, u8"[1,nul]", interner));
+    EXPECT_EQ_INT(JSON_NULL, second.get_type());
+
+    //-0 and 0 are equal but keep their sign
+    JsonValue zeros;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(zeros, u8"[0,-0]"));
+    std::u8string expect = zeros.to_string(), actual;
+    JsonSharedValue shared_zeros(zeros);
+    json_dedup(shared_zeros);
+    actual = shared_zeros.to_string();
+    EXPECT_EQ_STRING(expect, actual);
+    EXPECT_EQ_INT(PARSE_OK, json_parse(second, u8"[0,-0]", interner));
+    actual = second.to_string();
+    EXPECT_EQ_STRING(expect, actual);
+}
+
+#define TEST_PATCH(expect_ret, expect, doc, patch_json)                  \
+    do                                                                  \
+    {                                                                   \
+        JsonValue target, patch, result;                                \
+        EXPECT_EQ_INT(PARSE_OK, json_parse(target, doc));               \
+        EXPECT_EQ_INT(PARSE_OK, json_parse(patch, patch_json));         \
+        EXPECT_EQ_INT(PARSE_OK, json_parse(result, expect));            \
+        EXPECT_EQ_INT(expect_ret, json_patch(target, std::move(patch))); \
+        std::u8string expect_string = result.to_string();              \
+        std::u8string actual_string = target.to_string();              \
+        EXPECT_EQ_STRING(expect_string, actual_string);                \
+    } while(0)
+
+static void test_patch() {
+    //RFC 7396 example
+    JsonValue target, patch, expect;
+    json_parse(target, u8"{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\",\"familyName\":\"Doe\"},"
+                       u8"\"tags\":[\"example\",\"sample\"],\"content\":\"This will be unchanged\"}");
+    json_parse(patch, u8"{\"title\":\"Hello!\",\"phoneNumber\":\"+01-555-1234\",\"author\":{\"familyName\":null},\"tags\":[\"example\"]}");
+    json_parse(expect, u8"{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},\"tags\":[\"example\"],"
+                       u8"\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-555-1234\"}");
+    auto *content = &target.get_object()[u8"content"];
+    json_merge_patch(target, std::move(patch));
+    EXPECT_EQ_INT(1, target == expect);
+    //Untouched members stay where they are
+    EXPECT_EQ_INT(1, content == &target.get_object()[u8"content"]);
+    json_parse(patch, u8"[1]");
+    json_merge_patch(target, patch);
+    EXPECT_EQ_INT(1, target == patch);
+
+    //RFC 6902 examples
+    TEST_PATCH(PARSE_OK, u8"{\"baz\":\"qux\",\"foo\":\"bar\"}", u8"{\"foo\":\"bar\"}", u8"[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]");
+    TEST_PATCH(PARSE_OK, u8"{\"foo\":[\"bar\",\"qux\",\"baz\"]}", u8"{\"foo\":[\"bar\",\"baz\"]}", u8"[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]");
+    TEST_PATCH(PARSE_OK, u8"{\"foo\":[\"bar\",\"baz\"]}", u8"{\"foo\":[\"bar\",\"qux\",\"baz\"]}", u8"[{\"op\":\"remove\",\"path\":\"/foo/1\"}]");
+    TEST_PATCH(PARSE_OK, u8"{\"baz\":\"boo\",\"foo\":\"bar\"}", u8"{\"baz\":\"qux\",\"foo\":\"bar\"}", u8"[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]");
+    TEST_PATCH(PARSE_OK, u8"{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}",
+               u8"{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+               u8"[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]");
+    TEST_PATCH(PARSE_OK, u8"{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}", u8"{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+               u8"[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]");
+    TEST_PATCH(PARSE_OK, u8"{\"foo\":[\"bar\",[\"abc\",\"def\"]]}", u8"{\"foo\":[\"bar\"]}", u8"[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]");
+    TEST_PATCH(PARSE_OK, u8"{\"a\":{\"b\":1},\"c\":{\"b\":1}}", u8"{\"a\":{\"b\":1}}", u8"[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/c\"},{\"op\":\"test\",\"path\":\"/c/b\",\"value\":1}]");
+    TEST_PATCH(PARSE_OK, u8"[1]", u8"{\"a\":1}", u8"[{\"op\":\"add\",\"path\":\"\",\"value\":[1]}]");
+    //A failed operation rolls back the ones before it
+    TEST_PATCH(PARSE_PATCH_TEST_FAILED, u8"{\"baz\":\"qux\",\"foo\":[\"bar\"]}", u8"{\"baz\":\"qux\",\"foo\":[\"bar\"]}",
+               u8"[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":1},{\"op\":\"remove\",\"path\":\"/baz\"},"
+               u8"{\"op\":\"move\",\"from\":\"/foo/0\",\"path\":\"/x\"},{\"op\":\"replace\",\"path\":\"/x\",\"value\":2},"
+               u8"{\"op\":\"move\",\"from\":\"/x\",\"path\":\"/foo/0\"},{\"op\":\"test\",\"path\":\"/foo/0\",\"value\":3}]");
+    TEST_PATCH(PARSE_PATCH_PATH_NOT_FOUND, u8"{\"foo\":\"bar\"}", u8"{\"foo\":\"bar\"}",
+               u8"[{\"op\":\"remove\",\"path\":\"/foo\"},{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]");
+    TEST_PATCH(PARSE_PATCH_PATH_NOT_FOUND, u8"{\"a\":{\"b\":[1]}}", u8"{\"a\":{\"b\":[1]}}",
+               u8"[{\"op\":\"move\",\"from\":\"/a/b\",\"path\":\"/a/c/d\"}]");
+    TEST_PATCH(PARSE_INVALID_PATCH, u8"{\"a\":{\"b\":1}}", u8"{\"a\":{\"b\":1}}", u8"[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b\"}]");
+    TEST_PATCH(PARSE_INVALID_PATCH, u8"[1]", u8"[1]", u8"[{\"op\":\"add\",\"path\":\"/0\"}]");
+    TEST_PATCH(PARSE_PATCH_PATH_NOT_FOUND, u8"[1]", u8"[1]", u8"[{\"op\":\"add\",\"path\":\"/2\",\"value\":2}]");
+
+    //A diff applied to its source gives the target
+    JsonValue from, to;
+    json_parse(from, u8"{\"a\":[1,2,3,4,5],\"b\":{\"c\":\"d\",\"e\":[]},\"f\":true,\"g~/\":1}");
+    json_parse(to, u8"{\"a\":[1,9,2,3,5],\"b\":{\"c\":\"x\",\"n\":null},\"f\":[true],\"g~/\":1}");
+    JsonValue diff = json_diff(from, to);
+    EXPECT_EQ_INT(PARSE_OK, json_patch(from, diff));
+    EXPECT_EQ_INT(1, from == to);
+    diff = json_diff(from, to);
+    EXPECT_EQ_INT(0, (int)diff.get_array().size());
+    json_parse(from, u8"[0,1,2,3,4,5,6,7,8,9]");
+    json_parse(to, u8"[0,1,2,3,4,42,5,6,7,8,9]");
+    std::u8string diff_string = json_diff(from, to).to_string();
+    EXPECT_EQ_STRING(std::u8string(u8"[{\"op\":\"add\",\"path\":\"\\/5\",\"value\":42.000000}]"), diff_string);
+    //Raw ids past 2^53 that round to the same double still differ
+    JsonParseOptions options;
+    options.raw_numbers = true;
+    json_parse(from, u8"{\"id\":9007199254740992,\"ids\":[18446744073709551615]}", options);
+    json_parse(to, u8"{\"id\":9007199254740993,\"ids\":[18446744073709551614]}", options);
+    diff = json_diff(from, to);
+    EXPECT_EQ_INT(2, (int)diff.get_array().size());
+    EXPECT_EQ_INT(PARSE_OK, json_patch(from, diff));
+    EXPECT_EQ_INT(1, from == to);
+    diff_string = from.to_string();
+    EXPECT_EQ_STRING(std::u8string(u8"{\"id\":9007199254740993,\"ids\":[18446744073709551614]}"), diff_string);
+    JsonValue patch_test;
+    json_parse(patch_test, u8"[{\"op\":\"test\",\"path\":\"/id\",\"value\":9007199254740992}]", options);
+    EXPECT_EQ_INT(PARSE_PATCH_TEST_FAILED, json_patch(from, patch_test));
+    json_parse(patch_test, u8"[{\"op\":\"test\",\"path\":\"/id\",\"value\":9007199254740993}]", options);
+    EXPECT_EQ_INT(PARSE_OK, json_patch(from, patch_test));
+}
+
+static void test_static_parse() {
+    //Compile-time numbers match strtod on the fast path
+    for(auto number: {u8"3.1416", u8"1E-10", u8"-1.234E+10", u8"123456789012345", u8"0.1", u8"1e22"})
+        EXPECT_EQ_DOUBLE(json_decode_number(number), json_static_number(number));
+    EXPECT_EQ_INT(1, json_static_number(u8"1e400") == HUGE_VAL);
+    //and are correctly rounded off it: long mantissas, large powers, subnormals and halfway cases
+    static_assert(json_static_number(u8"1e-300") == 1e-300);
+    std::u8string long_zeros(800, u8'0');
+    std::u8string long_numbers[] = {u8"1" + long_zeros + u8"e-800", u8"9007199254740993." + long_zeros + u8"1",
+                                    u8"9007199254740993." + long_zeros, u8"0." + long_zeros + u8"123e700",
+                                    u8"2.4703282292062327208828439643411068618252990130716238221279284125033775363510437593264991818081799618989828234772285886546332835517796989819938739800539093906315035659515570226392290858392449105184435931802849936536152500319370457678249219365623669863658480757001585769269903706311928279558551332927834338409351978015531246597263579574622766465272827220056374006485499977096599470454020828166226237857393450736339007967761930577506740176324673600968951340535537458516661134223766678604162159680461914467291840300530057530849048765391711386591646239524912623653881879636239373280423891018672348497668235089863388587925628302755995657524455507255189313690836254779186948667994968324049705821028513185451396213837722826145437693412532098591327667236328125e-324"};
+    for(auto &number : long_numbers)
+        EXPECT_EQ_DOUBLE(json_decode_number(number), json_static_number(number));
+    for(auto number: {u8"1e-300", u8"-1e-300", u8"1e23", u8"8.98846567431158e307", u8"1.7976931348623157e308",
+                      u8"1.7976931348623158e308", u8"1.7976931348623159e308", u8"2.2250738585072011e-308",
+                      u8"2.2250738585072012e-308", u8"4.9406564584124654e-324", u8"2.4703282292062328e-324",
+                      u8"2.4703282292062327e-324", u8"1e-400", u8"9007199254740993", u8"9007199254740995",
+                      u8"12345678901234567890123", u8"3.14159265358979323846264338327950288", u8"123456789e-30",
+                      u8"0.000000000000000000000000000001", u8"7.038531e-26", u8"1448997445238699"})
+        EXPECT_EQ_DOUBLE(json_decode_number(number), json_static_number(number));
+    //Round trips of doubles spread over the whole range
+    int mismatches = 0;
+    uint64_t state = 88172645463325252u;
+    for(int i = 0; i < 2000; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        double d = std::bit_cast<double>(state & ~(uint64_t(1) << 63));
+        if(std::isinf(d) || std::isnan(d))
+            continue;
+        char buffer[32];
+        auto end = std::to_chars(buffer, buffer + sizeof(buffer), d, std::chars_format::scientific, 17).ptr;
+        mismatches += json_static_number(json_as_u8(buffer, end - buffer)) != d;
+    }
+    EXPECT_EQ_INT(0, mismatches);
+
+    //The numbers of a static document are raw
+    JsonValue expect;
+    JsonParseOptions raw;
+    raw.raw_numbers = true;
+    json_parse(expect, u8"{\"Name\": \"中😀\", \"Port\": 8080, \"Ratio\": -1.25e-2,"
+                       u8" \"Tags\": [null, true, {}], \"Id\": 9007199254740993}", raw);
+    JsonValue actual = static_config.root().to_value();
+    EXPECT_EQ_INT(1, expect == actual);
+    EXPECT_EQ_INT(1, actual.get_object()[u8"Id"].get_int64() == 9007199254740993);
+}
+
+class CountingBudget : public JsonMemoryBudget
+{
+public:
+    explicit CountingBudget(size_t limit) : limit(limit) {}
+    bool charge(size_t bytes) override
+    {
+        calls++;
+        if(bytes > limit - used)
+            return false;
+        used += bytes;
+        return true;
+    }
+    size_t limit, used = 0, calls = 0;
+};
+
+static void test_memory() {
+    const char8_t *json = u8"{\"name\":\"a string longer than the inline buffer\",\"short\":\"x\","
+                          u8"\"a key longer than the inline buffer\":[1,2,3,[],{\"k\":null}],\"n\":1.5}";
+    JsonValue v;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(v, json));
+    JsonMemoryUsage usage = v.memory_usage();
+    EXPECT_EQ_INT((int)(10 * sizeof(JsonValue) + 5 * (JSON_MEMBER_BYTES - sizeof(JsonValue))), (int)(usage.nodes + usage.objects));
+    EXPECT_EQ_INT(1, usage.strings > 2 * 34);
+    EXPECT_EQ_INT(1, usage.arrays % sizeof(JsonValue) == 0);
+    EXPECT_EQ_INT(1, usage.total() == usage.nodes + usage.strings + usage.arrays + usage.objects);
+    EXPECT_EQ_INT(0, (int)JsonValue(1.0).memory_usage().total());
+
+    //Every allocation of a fresh tree is charged, in bytes that add up to
+    //memory_usage() once the parser's scratch key is large enough
+    CountingBudget counter(SIZE_MAX);
+    JsonParseOptions options;
+    options.memory_budget = &counter;
+    JsonValue tracked;
+    JsonParser warm;
+    EXPECT_EQ_INT(PARSE_OK, warm.parse(json, tracked, options));
+    EXPECT_EQ_INT(1, counter.used > usage.total());
+    counter.used = 0;
+    tracked = JsonValue();
+    EXPECT_EQ_INT(PARSE_OK, warm.parse(json, tracked, options));
+    EXPECT_EQ_INT(1, tracked == v);
+    EXPECT_EQ_INT((int)usage.total(), (int)counter.used);
+    options.raw_numbers = true;
+    counter.used = 0;
+    JsonValue raw;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(raw, u8"[12345678901234567890.5,1]", options));
+    EXPECT_EQ_INT((int)raw.memory_usage().total(), (int)counter.used);
+    options.raw_numbers = false;
+
+    //Budgets abort before the allocation that would exceed them
+    for(size_t budget : {size_t(0), size_t(100), usage.total() - 1})
+    {
+        CountingBudget limited(budget);
+        JsonValue fresh;
+        options.memory_budget = &limited;
+        EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(fresh, json, options));
+        EXPECT_EQ_INT(1, limited.used <= budget);
+        EXPECT_EQ_INT(JSON_NULL, fresh.get_type());
+    }
+    options.memory_budget = nullptr;
+    options.max_bytes = usage.total() - 1;
+    JsonValue over, exact;
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, warm.parse(json, over, options));
+    options.max_bytes = usage.total();
+    EXPECT_EQ_INT(PARSE_OK, warm.parse(json, exact, options));
+    options.max_bytes = SIZE_MAX;
+
+    //Values, and the length of strings, keys, arrays and objects
+    options.max_values = 10;
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(tracked, json, options));
+    options.max_values = 11;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(tracked, json, options));
+    options.max_values = SIZE_MAX;
+    options.max_length = 5;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(tracked, u8"[\"12345\",{\"abcde\":[1,2,3,4,5]}]", options));
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(tracked, u8"[\"123456\"]", options));
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(tracked, u8"{\"abcdef\":1}", options));
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(tracked, u8"[1,2,3,4,5,6]", options));
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(tracked, u8"{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6}", options));
+    EXPECT_EQ_INT(PARSE_OK, json_parse(tracked, u8"{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"a\":6}", options));
+    //Long keys are charged while they are decoded, not once they are complete
+    options.max_length = SIZE_MAX;
+    options.max_bytes = 100;
+    std::u8string long_key = u8"{\"" + std::u8string(100000, u8'k') + u8"\":1}";
+    size_t before = allocations;
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(tracked, long_key, options));
+    EXPECT_EQ_INT(1, allocations - before < 5);
+    options.max_bytes = SIZE_MAX;
+    options.max_length = 5;
+    //Syntax errors are still reported as such
+    EXPECT_EQ_INT(PARSE_INVALID_STRING_END, json_parse(tracked, u8"[\"1234567", options));
+
+    //A reused parser only charges what the tree grows by
+    JsonParser parser;
+    CountingBudget reused(SIZE_MAX);
+    options.max_length = SIZE_MAX;
+    options.memory_budget = &reused;
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(json, tracked, options));
+    size_t first = reused.used;
+    EXPECT_EQ_INT(PARSE_OK, parser.parse(json, tracked, options));
+    EXPECT_EQ_INT(1, first > 0 && first == reused.used);
+
+    //Members left over from other keys and documents are not recycled
+    //under limits, they still hold the arrays of the first document
+    std::u8string wide_arrays = u8"{", wide_numbers = u8"{";
+    for(int i = 0; i < 20; i++)
+    {
+        std::string index = std::to_string(i);
+        wide_arrays += (i ? u8",\"a" : u8"\"a") + std::u8string(index.begin(), index.end()) + u8"\":[1,2,3,4,5,6,7,8]";
+        wide_numbers += (i ? u8",\"b" : u8"\"b") + std::u8string(index.begin(), index.end()) + u8"\":1";
+    }
+    wide_arrays += u8"}";
+    wide_numbers += u8"}";
+    JsonValue expect_numbers;
+    EXPECT_EQ_INT(PARSE_OK, json_parse(expect_numbers, wide_numbers));
+    JsonParser pooled;
+    JsonValue target;
+    EXPECT_EQ_INT(PARSE_OK, pooled.parse(wide_arrays, target));
+    EXPECT_EQ_INT(PARSE_OK, pooled.parse(u8"{\"n\":1}", target));
+    CountingBudget pooled_budget(SIZE_MAX);
+    options.memory_budget = &pooled_budget;
+    options.max_bytes = expect_numbers.memory_usage().total();
+    EXPECT_EQ_INT(PARSE_OK, pooled.parse(wide_numbers, target, options));
+    EXPECT_EQ_INT(1, target == expect_numbers);
+    EXPECT_EQ_INT(1, target.memory_usage().total() <= options.max_bytes);
+    EXPECT_EQ_INT((int)target.memory_usage().total(), (int)pooled_budget.used);
+    options.memory_budget = nullptr;
+    options.max_bytes = SIZE_MAX;
+}
+
+// Source of json_parse_async() that always has its bytes ready, a few at a time
+struct ReadySource
+{
+    std::u8string_view json;
+    struct Read
+    {
+        ReadySource &source;
+        char8_t *buffer;
+        size_t size;
+        bool await_ready() { return true; }
+        void await_suspend(std::coroutine_handle<>) {}
+        size_t await_resume()
+        {
+            size_t n = std::min<size_t>({size, 3, source.json.size()});
+            std::copy_n(source.json.begin(), n, buffer);
+            source.json.remove_prefix(n);
+            return n;
+        }
+    };
+    Read read(char8_t *buffer, size_t size) { return Read{*this, buffer, size}; }
+};
+
+static void test_stream_limits() {
+    //Streamed documents are held to the same limits as json_parse()
+    std::u8string long_string = u8"[\"" + std::u8string(1000, u8'x') + u8"\"]";
+    std::u8string long_key = u8"{\"" + std::u8string(1000, u8'k') + u8"\":1}";
+    std::u8string docs[] = {u8"[1,2,3]", u8"{\"a\":\"12345\",\"b\":[true,null],\"c\":[[1,2],[3]]}",
+                            u8"{\"a\":1,\"a\":[1,2,3]}", u8"[1,2,3,4,5,6]", u8"[[[[[[[[[[[]]]]]]]]]]]", long_string, long_key};
+    CountingBudget counter(1000);
+    JsonParseOptions options[5];
+    options[0].max_values = 10;
+    options[1].max_length = 5;
+    options[2].max_bytes = 64;
+    options[3].max_bytes = 4096;
+    options[4].memory_budget = &counter;
+    for(auto &o : options)
+        for(auto &doc : docs)
+        {
+            JsonValue expect, actual, async;
+            counter.used = 0;
+            int ret = json_parse(expect, doc, o);
+            counter.used = 0;
+            std::istringstream stream(std::string(doc.begin(), doc.end()));
+            int stream_ret = json_parse(actual, stream, o, 4);
+            EXPECT_EQ_INT(ret, stream_ret);
+            std::u8string expect_string = expect.to_string(), actual_string = actual.to_string();
+            EXPECT_EQ_STRING(expect_string, actual_string);
+            counter.used = 0;
+            ReadySource source{doc};
+            JsonTask<int> task = json_parse_async(source, async, o);
+            task.start();
+            EXPECT_EQ_INT(1, task.done());
+            int async_ret = task.get();
+            EXPECT_EQ_INT(ret, async_ret);
+            EXPECT_EQ_INT(1, async == expect);
+        }
+
+    //A string spanning chunks is only buffered up to what the limits allow
+    options[1].max_length = 1000;
+    std::u8string huge = u8"[\"" + std::u8string(100000, u8'x') + u8"\"]";
+    std::istringstream stream(std::string(huge.begin(), huge.end()));
+    size_t before = allocations;
+    JsonValue v;
+    EXPECT_EQ_INT(PARSE_LIMIT_EXCEEDED, json_parse(v, stream, options[1], 64));
+    EXPECT_EQ_INT(1, allocations - before < 20);
+    EXPECT_EQ_INT(JSON_NULL, v.get_type());
+}
+
+static void test_front_end_parity() {
+    //Every front-end reports the error code of json_parse()
+    const char *inputs[] = {"0123", "-01", "[01]", "{\"a\":0123}", "1 2", "[1 2]", "[1}", "{\"a\":1 \"b\":2}", "{\"a\":1]",
+                            "", "  ", "-", "1.", "1e", "+1", "nul", "[nul]", "{\"a\":nul}", "\"abc", "\"\\x\"", "\"\\u12\"",
+                            "\"\\uD800\"", "\"a\x01\"", "[1,]", "[1", "[", "{", "{\"a\" 1}", "{1:2}", "{\"a\":}", "{\"a\":1,}",
+                            "{\"a\":1", "[\"a\"", "{\"a\":[1}", "[{]", "[1,2]]", "{}}", "-0", "[1.5e3,{\"a\":[true,null]}]",
+                            "{\"a\":1,b\":2}", "{k2\":1}", "[,]", "[1,,2]", "\"\\u00", "\"\\", "\"\\ud83d", "\"a\x01",
+                            "1e309", "[-1e999]", "{\"a\":1e999}"};
+    for(const char *input : inputs)
+    {
+        std::u8string json((const char8_t *)input);
+        JsonValue v;
+        int expect = json_parse(v, json);
+        JsonParser parser;
+        int parser_ret = parser.parse(json, v);
+        EXPECT_EQ_INT(expect, parser_ret);
+        std::istringstream stream(input);
+        int stream_ret = json_parse(v, stream, JsonParseOptions(), 3);
+        EXPECT_EQ_INT(expect, stream_ret);
+        FILE *file = tmpfile();
+        if(file)
+        {
+            fputs(input, file);
+            rewind(file);
+            int file_ret = json_parse(v, file, JsonParseOptions(), 2);
+            EXPECT_EQ_INT(expect, file_ret);
+            fclose(file);
+        }
+        ReadySource source{json};
+        JsonTask<int> task = json_parse_async(source, v);
+        task.start();
+        int async_ret = task.get();
+        EXPECT_EQ_INT(expect, async_ret);
+        //The transcoder copies numbers without converting them
+        int transcode_expect = expect == PARSE_NUMBER_TOO_BIG ? PARSE_OK : expect;
+        std::u8string out;
+        int transcode_ret = json_transcode(json, out);
+        EXPECT_EQ_INT(transcode_expect, transcode_ret);
+        JsonTranscoder transcoder;
+        int chunked_ret = PARSE_OK;
+        for(size_t i = 0; i < json.size() && chunked_ret == PARSE_OK; i += 2)
+            chunked_ret = transcoder.feed(std::u8string_view(json).substr(i, 2), out);
+        if(chunked_ret == PARSE_OK)
+            chunked_ret = transcoder.finish(out);
+        EXPECT_EQ_INT(transcode_expect, chunked_ret);
+        JsonSharedValue shared;
+        int shared_ret = json_parse(shared, json);
+        EXPECT_EQ_INT(expect, shared_ret);
+        JsonInterner interner;
+        int interned_ret = json_parse(shared, json, interner);
+        EXPECT_EQ_INT(expect, interned_ret);
+        JsonStaticDocument<64, 64> document;
+        int static_ret = document.parse(json);
+        EXPECT_EQ_INT(expect, static_ret);
+    }
+}
+
 static void test_parse() {
     test_parse_error();
     test_parse_null();
     test_parse_true();
     test_parse_false();
     test_parse_number();
+    test_parse_raw_number();
     test_parse_string();
     test_parse_array();
     test_parse_object();
     test_assignment();
     test_to_string();
+    test_parser_reuse();
+    test_shared_value();
+    test_schema();
+    test_events();
+    test_transcode();
+    test_index();
+    test_batch();
+    test_parse_cache();
+    test_parse_bytes();
+    test_parallel_writer();
+    test_dedup();
+    test_patch();
+    test_memory();
+    test_stream_limits();
+    test_front_end_parity();
+    test_static_parse();
+#if __has_include(<sys/socket.h>)
+    test_parse_async();
+#endif
 }
 
 int main() {